@@ -0,0 +1,171 @@
+/*
+ * bench.i --
+ *
+ * Benchmarks of YorXPA.  This script is run in batch mode by `run.sh` once
+ * the stand-in servers (see `server.i`) are running.  The following
+ * environment variables are used:
+ *
+ *   BENCH_SRCDIR    source directory of YorXPA;
+ *   BENCH_RESULTS   name of the file to write the results (in TSV format);
+ *   BENCH_SIZES     space separated list of payload sizes (in bytes);
+ *   BENCH_SERVERS   number of fan-out servers;
+ *   BENCH_REPS      number of repetitions of fast cases (default 100);
+ *   BENCH_RUN       index of the run (results of runs other than the first
+ *                   one are appended to the results file).
+ *
+ * The results file has one line per case with the following tab separated
+ * columns: name of the case, number of bytes per call, number of
+ * repetitions, mean, standard deviation, minimum, median and maximum of the
+ * duration of a call (in seconds) and throughput (in bytes per second,
+ * based on the median duration).  Lines starting with a `#` are comments.
+ *
+ *-----------------------------------------------------------------------------
+ *
+ * This file if part of the YorXPA (https://github.com/emmt/YorXPA) licensed
+ * under the MIT license.
+ *
+ * Copyright (C) 2018, Éric Thiébaut.
+ */
+
+plug_dir, _(".", plug_dir());
+include, get_env("BENCH_SRCDIR") + "/xpa.i";
+
+func bench_getenv(name, def)
+{
+    val = get_env(name);
+    if (! val) return def;
+    x = def;
+    if (sread(val, x) != 1) error, "bad value for " + name;
+    return x;
+}
+
+func bench_wait(apt, nmax)
+/* DOCUMENT bench_wait, apt, nmax;
+     Waits until `nmax` servers reply to access point `apt`.
+ */
+{
+    for (k = 1; k <= 300; ++k) {
+        if (xpa_get(apt, nmax=nmax)() >= nmax) return;
+        pause, 100;
+    }
+    error, "stand-in server(s) not responding for " + apt;
+}
+
+func bench_run(name, size, reps, expr, arg)
+/* DOCUMENT bench_run, name, size, reps, expr, arg;
+     Calls `expr(arg)` `reps` times (after a warm-up call), measures the
+     duration of each call and writes the results for case `name` where each
+     call transfers `size` bytes.
+ */
+{
+    extern bench_file;
+    t = array(double, reps);
+    expr, arg; /* warm-up */
+    for (k = 1; k <= reps; ++k) {
+        /* `timer, t1` adds the time elapsed since the previous call to
+           `timer` to `t1`. */
+        t0 = t1 = array(double, 3);
+        timer, t0;
+        expr, arg;
+        timer, t1;
+        t(k) = t1(3);
+    }
+    mean = avg(t);
+    std = (reps > 1 ? sqrt(sum((t - mean)^2)/(reps - 1)) : 0.0);
+    med = median(t);
+    rate = (med > 0 ? size/med : 0.0);
+    write, bench_file,
+        format="%s\t%d\t%d\t%.9g\t%.9g\t%.9g\t%.9g\t%.9g\t%.9g\n",
+        name, size, reps, mean, std, min(t), med, max(t), rate;
+    write, format="%-24s %12d bytes %6d reps  median %10.3f ms  %12.3f MB/s\n",
+        name, size, reps, 1e3*med, 1e-6*rate;
+}
+
+/* Functions to be benchmarked. */
+func bench_get(apt) { ans = xpa_get(apt); }
+func bench_set(ctx) { ans = xpa_set(ctx.apt, , ctx.data); }
+func bench_set_cmd(apt) { ans = xpa_set(apt, "cmd"); }
+func bench_get_into(ctx) { ans = xpa_get_into(ctx.apt, , ctx.data); }
+func bench_fanout(apts) { ans = xpa_get(apts); }
+func bench_sequential(apts)
+{
+    for (i = 1; i <= numberof(apts); ++i) ans = xpa_get(apts(i));
+}
+func bench_bytes(ans) { x = ans(1,3); }
+func bench_text(ans) { x = ans(1,4); }
+func bench_array(ctx) { ans = ctx.ans; x = ans(1, ctx.data); }
+
+func bench_main
+{
+    extern bench_file;
+    reps = bench_getenv("BENCH_REPS", 100);
+    nservers = bench_getenv("BENCH_SERVERS", 4);
+    sizes = array(long, 64);
+    nsizes = sread(get_env("BENCH_SIZES"), sizes);
+    sizes = (nsizes > 0 ? sizes(1:nsizes) : []);
+    results = get_env("BENCH_RESULTS");
+    if (! results) results = "bench-results.tsv";
+
+    bench_wait, "BENCH:bench", 1;
+    if (nservers > 0) {
+        bench_wait, "BENCH:fan*", nservers;
+    }
+    run = bench_getenv("BENCH_RUN", 1);
+    if (run > 1) {
+        /* Repeated runs are collected in the same file. */
+        bench_file = open(results, "a");
+    } else {
+        bench_file = create(results);
+        write, bench_file, format="# %s\n",
+            "case\tbytes\treps\tmean\tstd\tmin\tmedian\tmax\trate";
+    }
+    write, bench_file,
+        format="# YorXPA benchmarks, run %d, %s, XPA_METHOD=%s\n",
+        run, timestamp(), get_env("XPA_METHOD");
+
+    /* Latency of tiny commands. */
+    bench_run, "get_tiny", 3, reps, bench_get, "BENCH:bench";
+    bench_run, "set_tiny", 0, reps, bench_set_cmd, "BENCH:bench";
+
+    /* Throughput for increasing payload sizes. */
+    for (i = 1; i <= numberof(sizes); ++i) {
+        size = sizes(i);
+        n = max(3, min(reps, (1 << 28)/size));
+        apt = swrite(format="BENCH:bench_%d", size);
+        data = []; /* free the buffer of the previous size first */
+        data = array(char, size); /* shared by get_into and set cases */
+        bench_run, swrite(format="get_%d", size), size, n, bench_get, apt;
+        bench_run, swrite(format="get_into_%d", size), size, n,
+            bench_get_into, save(apt, data);
+        bench_run, swrite(format="set_%d", size), size, n,
+            bench_set, save(apt="BENCH:bench", data);
+    }
+    data = [];
+
+    /* Fan-out to several servers. */
+    if (nservers > 0) {
+        apts = swrite(format="BENCH:fan%d", indgen(nservers));
+        bench_run, swrite(format="fanout_%d", nservers), 3*nservers, reps,
+            bench_fanout, apts;
+        bench_run, swrite(format="sequential_%d", nservers), 3*nservers, reps,
+            bench_sequential, apts;
+    }
+
+    /* Cost of decoding the replies. */
+    if (numberof(sizes) > 0) {
+        size = sizes(min(numberof(sizes), 3));
+        ans = xpa_get(swrite(format="BENCH:bench_%d", size));
+        n = max(3, min(reps, (1 << 28)/size));
+        bench_run, swrite(format="decode_bytes_%d", size), size, n,
+            bench_bytes, ans;
+        bench_run, swrite(format="decode_text_%d", size), size, n,
+            bench_text, ans;
+        bench_run, swrite(format="decode_array_%d", size), size, n,
+            bench_array, save(ans, data=array(char, size));
+    }
+    close, bench_file;
+    write, format="Results written in \"%s\".\n", results;
+}
+
+bench_main;
+quit;
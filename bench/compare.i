@@ -0,0 +1,149 @@
+/*
+ * compare.i --
+ *
+ * Comparison of benchmark results of YorXPA to detect performance
+ * regressions.  This file can be included by Yorick to use `bench_compare`
+ * or run in batch mode (e.g. by "make bench-compare") in which case the
+ * following environment variables are used:
+ *
+ *   BENCH_BASELINE   name of the results file of the reference;
+ *   BENCH_RESULTS    name of the results file to check (default
+ *                    "bench-results.tsv");
+ *   BENCH_BUDGET     maximum allowed relative slowdown (default 0.10);
+ *   BENCH_Z          number of standard errors for the confidence interval
+ *                    (default 1.96, that is 95%).
+ *
+ * In batch mode, an error is thrown (hence Yorick exits with a non-zero
+ * status) if the budget is exceeded.
+ *
+ *-----------------------------------------------------------------------------
+ *
+ * This file if part of the YorXPA (https://github.com/emmt/YorXPA) licensed
+ * under the MIT license.
+ *
+ * Copyright (C) 2018, Éric Thiébaut.
+ */
+
+func bench_load(filename)
+/* DOCUMENT res = bench_load(filename);
+
+     Loads the benchmark results in file `filename` (as written by
+     `bench/bench.i`).  The result is an object with members `name`, `bytes`,
+     `reps`, `mean` and `std` (one element per case).  Cases appearing more
+     than once (the file may collect several runs) are merged: the number of
+     repetitions are summed and the mean and standard deviation are computed
+     as if all the samples had been collected together, so that the
+     variability between runs is accounted for.
+
+   SEE ALSO bench_compare.
+ */
+{
+    file = open(filename);
+    name = bytes = reps = mean = var = [];
+    while ((line = rdline(file))) {
+        if (strpart(line, 1:1) == "#" || strlen(line) == 0) continue;
+        s = string(0);
+        b = r = 0;
+        m = sd = mn = md = mx = rt = 0.0;
+        if (sread(line, s, b, r, m, sd, mn, md, mx, rt) != 10 || r < 1) {
+            error, "bad line in \"" + filename + "\": " + line;
+        }
+        k = (is_void(name) ? [] : where(name == s));
+        if (numberof(k)) {
+            /* Merge with previous runs. */
+            k = k(1);
+            n1 = reps(k);
+            n = n1 + r;
+            m1 = mean(k);
+            mean(k) = (n1*m1 + r*m)/n;
+            var(k) = ((n1 - 1)*var(k) + (r - 1)*sd^2 +
+                      n1*(m1 - mean(k))^2 + r*(m - mean(k))^2)/max(n - 1, 1);
+            reps(k) = n;
+        } else {
+            grow, name, s;
+            grow, bytes, b;
+            grow, reps, r;
+            grow, mean, m;
+            grow, var, sd^2;
+        }
+    }
+    close, file;
+    if (is_void(name)) error, "no results in \"" + filename + "\"";
+    return save(name, bytes, reps, mean, std=sqrt(var));
+}
+
+func bench_compare(base, curr, budget=, z=)
+/* DOCUMENT nfail = bench_compare(base, curr);
+
+     Compares the benchmark results in files `base` (the reference) and
+     `curr`, prints a table of the relative change of the mean duration of
+     each case and yields the number of cases whose slowdown exceeds the
+     budget.
+
+     To be robust to noise, a case fails only if the lower bound of the
+     confidence interval of its relative slowdown is larger than the budget.
+     The confidence interval is `delta ± z*se/mean0` where `delta` is the
+     relative change of the mean duration, `se` the standard error of the
+     difference of the means (computed from the standard deviations and the
+     number of repetitions of both runs) and `mean0` the mean duration of the
+     reference.  Keyword `budget` is the maximum allowed relative slowdown
+     (default 0.10, that is 10%) and keyword `z` is the number of standard
+     errors (default 1.96, that is a confidence of 95%).
+
+     The duration is that of a call, so a slowdown is an increase of the
+     latency for small commands and a decrease of the throughput for large
+     transfers.  Cases which are not present in both files are ignored.
+
+   SEE ALSO bench_load.
+ */
+{
+    if (is_void(budget)) budget = 0.10;
+    if (is_void(z)) z = 1.96;
+    a = bench_load(base);
+    b = bench_load(curr);
+    nfail = 0;
+    write, format="%-28s %12s %12s %9s %9s  %s\n",
+        "CASE", "BASE (ms)", "CURR (ms)", "DELTA", "+/-", "STATUS";
+    for (i = 1; i <= numberof(b.name); ++i) {
+        k = where(a.name == b.name(i));
+        if (! numberof(k)) continue;
+        k = k(1);
+        m0 = a.mean(k);
+        m1 = b.mean(i);
+        if (m0 <= 0) continue;
+        se = sqrt(a.std(k)^2/a.reps(k) + b.std(i)^2/b.reps(i));
+        delta = (m1 - m0)/m0;
+        err = z*se/m0;
+        if (delta - err > budget) {
+            status = "REGRESSION";
+            ++nfail;
+        } else if (delta + err < -budget) {
+            status = "improved";
+        } else if (abs(delta) > budget) {
+            status = "noisy";
+        } else {
+            status = "ok";
+        }
+        write, format="%-28s %12.4f %12.4f %+8.1f%% %8.1f%%  %s\n",
+            b.name(i), 1e3*m0, 1e3*m1, 1e2*delta, 1e2*err, status;
+    }
+    return nfail;
+}
+
+if (batch()) {
+    base = get_env("BENCH_BASELINE");
+    curr = get_env("BENCH_RESULTS");
+    if (! base) error, "BENCH_BASELINE must be set";
+    if (! curr) curr = "bench-results.tsv";
+    budget = 0.10;
+    z = 1.96;
+    if (get_env("BENCH_BUDGET")) sread, get_env("BENCH_BUDGET"), budget;
+    if (get_env("BENCH_Z")) sread, get_env("BENCH_Z"), z;
+    nfail = bench_compare(base, curr, budget=budget, z=z);
+    if (nfail > 0) {
+        error, swrite(format="%d case(s) exceed the performance budget (%g%%)",
+                      nfail, 1e2*budget);
+    }
+    write, format="%s\n", "No performance regressions.";
+    quit;
+}
@@ -0,0 +1,60 @@
+#! /bin/sh
+#
+# Run the benchmarks of YorXPA with local stand-in XPA servers.  This script
+# is normally run by "make bench" from the build directory (where the plug-in
+# has been compiled).  The following environment variables may be set:
+#
+#   YORICK          Yorick executable (default "yorick");
+#   BENCH_RESULTS   name of the results file (default "bench-results.tsv");
+#   BENCH_SIZES     payload sizes in bytes (default from 1 KB to 32 MB, larger
+#                   sizes such as 1073741824 must be given explicitly as
+#                   every size is published by the server and allocated by
+#                   the benchmark);
+#   BENCH_SERVERS   number of servers for fan-out (default 4);
+#   BENCH_REPS      number of repetitions of fast cases (default 100);
+#   BENCH_RUNS      number of runs collected in the results file (default 1).
+#
+#------------------------------------------------------------------------------
+#
+# This file if part of the YorXPA (https://github.com/emmt/YorXPA) licensed
+# under the MIT license.
+#
+# Copyright (C) 2018, Éric Thiébaut.
+#
+#------------------------------------------------------------------------------
+
+BENCH_SRCDIR=$(cd "$(dirname "$0")/.." && pwd)
+: ${YORICK:=yorick}
+: ${BENCH_RESULTS:=bench-results.tsv}
+: ${BENCH_SIZES:="1024 32768 1048576 33554432"}
+: ${BENCH_SERVERS:=4}
+: ${BENCH_REPS:=100}
+: ${BENCH_RUNS:=1}
+
+# Use unix sockets so that no network is needed and the results do not
+# depend on the network configuration.
+XPA_METHOD=local
+export XPA_METHOD BENCH_SRCDIR BENCH_RESULTS BENCH_SIZES BENCH_SERVERS \
+       BENCH_REPS
+
+pids=""
+cleanup () {
+    test -n "$pids" && kill $pids 2>/dev/null
+}
+trap cleanup 0 INT TERM
+
+BENCH_NAME=bench "$YORICK" -batch "$BENCH_SRCDIR/bench/server.i" &
+pids="$pids $!"
+k=1
+while test $k -le $BENCH_SERVERS; do
+    BENCH_NAME="fan$k" BENCH_SIZES="" \
+        "$YORICK" -batch "$BENCH_SRCDIR/bench/server.i" &
+    pids="$pids $!"
+    k=$(expr $k + 1)
+done
+
+run=1
+while test $run -le $BENCH_RUNS; do
+    BENCH_RUN=$run "$YORICK" -batch "$BENCH_SRCDIR/bench/bench.i" || exit 1
+    run=$(expr $run + 1)
+done
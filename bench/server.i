@@ -0,0 +1,45 @@
+/*
+ * server.i --
+ *
+ * Stand-in XPA server for the benchmarks of YorXPA.  This script is run in
+ * batch mode by `run.sh`, the following environment variables are used:
+ *
+ *   BENCH_SRCDIR   source directory of YorXPA;
+ *   BENCH_NAME     name of the server (e.g. "bench" or "fan1");
+ *   BENCH_SIZES    space separated list of payload sizes (in bytes) to
+ *                  publish (none if empty).
+ *
+ * The server provides the following access points:
+ *
+ *   BENCH:<name>            replies "ok" to XPA get requests and discards
+ *                           the data of XPA set requests;
+ *   BENCH:<name>_<size>     publishes (without copy) an array of <size>
+ *                           bytes for each <size> in BENCH_SIZES.
+ *
+ *-----------------------------------------------------------------------------
+ *
+ * This file if part of the YorXPA (https://github.com/emmt/YorXPA) licensed
+ * under the MIT license.
+ *
+ * Copyright (C) 2018, Éric Thiébaut.
+ */
+
+plug_dir, _(".", plug_dir());
+include, get_env("BENCH_SRCDIR") + "/xpa.i";
+
+func bench_send(params) { return "ok"; }
+func bench_recv(params, data) { }
+
+bench_name = get_env("BENCH_NAME");
+bench_aps = save();  /* keep servers in use */
+save, bench_aps, string(0),
+    xpa_server("BENCH:" + bench_name, bench_send, bench_recv);
+bench_sizes = array(long, 64);
+n = sread(get_env("BENCH_SIZES"), bench_sizes);
+for (i = 1; i <= n; ++i) {
+    save, bench_aps, string(0),
+        xpa_publish(swrite(format="BENCH:%s_%d", bench_name, bench_sizes(i)),
+                    array(char, bench_sizes(i)));
+}
+xpa_serve;
+quit;
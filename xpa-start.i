@@ -1 +1,6 @@
-autoload, "xpa.i", xpa_array, xpa_get, xpa_get_text, xpa_list, xpa_set, xpa_text;
+autoload, "xpa.i", xpa_array, xpa_capture, xpa_close, xpa_fastest_method,
+  xpa_fits, xpa_get, xpa_get_async, xpa_get_fd, xpa_get_into, xpa_get_text,
+  xpa_lanes, xpa_latency, xpa_list, xpa_open, xpa_publish, xpa_queue_config,
+  xpa_queue_flush, xpa_queue_set, xpa_queue_stats, xpa_receive, xpa_replay,
+  xpa_resolver, xpa_serve, xpa_server, xpa_servers, xpa_set, xpa_set_async,
+  xpa_set_file, xpa_set_image, xpa_stats, xpa_text, xpa_trace, xpa_trace_save;
@@ -20,16 +20,73 @@ extern xpa_get;
      identifying the XPA access point(s) of the destination server(s).
      Argument `cmd` is an optional textual command (a string or nil).
 
+     Argument `apt` may also be an array of strings, in which case the
+     command is sent to all the given access points in parallel (each one by
+     a transfer process, see below) and all the replies are collected in a
+     single answer, in the same order as the access points.  The elapsed
+     time is then that of the slowest server rather than the sum of the
+     times taken by every server.  At most 32 commands run concurrently in
+     the control lane (see `xpa_lanes` for the bulk lane), the others wait
+     for a transfer process to be available.  An access point is preferably
+     served by the transfer process which served it last, so that its
+     connection is reused from one call to the next.
+
      Keyword `nmax` may be used to specify the maximum number of recipients.
-     By default, `nmax=1`.  Specifying `nmax=-1` will use the maximum possible
-     number of recipients.
+     By default, `nmax=1`.  Specifying `nmax=-1` will address all the access
+     points matching `apt` (their number is queried from the name server).
+     There is no upper limit for the number of recipients.
+
+     Keyword `conn` may be set with a connection opened by `xpa_open` to use
+     instead of the shared persistent connection (only for a single access
+     point).
+
+     Keyword `lane` may be set with "control" (the default) or "bulk" to
+     choose the lane of the command.  Bulk commands are run by a separate
+     pool of transfer processes so that big transfers never hold the
+     transfer processes used by control commands (see `xpa_lanes`).
+     Combined with `xpa_set_async` or `xpa_get_async`, this lets small
+     control commands keep their low latency while bulk transfers are in
+     progress.
+
+     Keyword `timeout` may be set with the maximum number of seconds to wait
+     for the replies instead of the global XPA timeouts (XPA_SHORT_TIMEOUT
+     and XPA_LONG_TIMEOUT).  For a single access point, the command is run
+     as usual by its connection with both XPA timeouts set to `timeout`
+     rounded up to whole seconds for the duration of the call, a server
+     which has not replied in time yields the timeout error reply of XPA.
+     For several access points (or in the bulk lane), the commands are run
+     by transfer processes and, if a server has not replied in time, the
+     command returns with an error reply ("XPA$ERROR timeout ...") for the
+     access point; the transfer process of the abandoned command is killed,
+     so hung servers never hold the transfer processes of the lane.  The
+     time limit includes the name server lookup for `nmax=-1`.
+
+     Keywords `ack`, `doxpa` and `verify` set the corresponding options of
+     the XPA mode string of the command (by default the XPA defaults apply).
+     For instance, `ack=0` for an XPA set command does not wait for the
+     acknowledgment of the server which makes fire-and-forget commands
+     return at once and `verify=1` makes XPA print the command sent to the
+     servers.  Keyword `doxpa` has no effect while Yorick serves access
+     points (see `xpa_server`): they are never served while waiting.
+
+     As the XPA library is not thread-safe, commands which run concurrently
+     (fan-out, bulk lane, asynchronous and queued commands) are
+     executed by transfer processes: long-lived child processes of Yorick,
+     started when needed, which keep their own persistent XPA connection
+     and run the commands they receive one at a time, sending back the
+     replies through a socket.  Data to send are written to the transfer
+     process when the command starts, files are passed to it.  Transfer
+     processes never serve the access points of this process (`doxpa` is
+     always false for them).
 
      The returned object collects the answers of the recipients and can be
      indexed as follows to retrieve the contents of the received answers:
 
        ans()      yields the number of replies;
        ans(i)     yields the message of `i`-th reply;
-       ans(i,)    yields the data size of the `i`-th reply;
+       ans(i,)    yields the data size of the `i`-th reply (or the number of
+                  bytes written elsewhere, see `xpa_get_into` and
+                  `xpa_get_fd`);
        ans(i,arr) copies data from `i`-th reply into array `arr` (sizes must
                   match) and yields `arr`;
        ans(i,0)   yields `0` if there is no message for `i`-th reply, `1` if
@@ -63,57 +120,985 @@ extern xpa_set;
      nil).
 
      The returned object collects the answers ot the recipients and has
-     similar semantic as the object returned by `xpa_get`.
+     similar semantic as the object returned by `xpa_get`.  As for `xpa_get`,
+     `apt` may be an array of access points to address in parallel.
 
      Keyword `nmax` may be used to specify the maximum number of recipients.
-     By default, `nmax=1`.  Specifying `nmax=-1` will use the maximum possible
-     number of recipients.
+     By default, `nmax=1`.  Specifying `nmax=-1` will address all the access
+     points matching `apt` (their number is queried from the name server).
+     There is no upper limit for the number of recipients.  Keywords `conn`
+     and `lane` may be used to specify the connection or the lane as for
+     `xpa_get`.  Keywords `timeout`, `ack`, `doxpa` and `verify` are also as
+     for `xpa_get`; for instance:
 
+       xpa_set, "ds9", "frame next", ack=0;
 
-   SEE ALSO xpa_get, xpa_list.
+     sends a command without waiting for its acknowledgment.
+
+   SEE ALSO xpa_get, xpa_list, xpa_open.
  */
 
-func xpa_list(nil)
-/* DOCUMENT lst = xpa_list();
-         or xpa_list;
+extern xpa_open;
+extern xpa_close;
+/* DOCUMENT conn = xpa_open(method=...);
+         or conn = xpa_open(apt, method=..., nmax=...);
+         or n = conn(apt, nmax=...);
+         or bool = conn();
+         or xpa_close, conn;
 
-     This function retrieves a list of the current XPA servers.  If called as a
-     function, a list of strings (or nil if there are no servers) is returned;
-     otherwise the list of servers is printed.
+     The function `xpa_open` opens a persistent XPA client connection which
+     can be used by `xpa_get`, `xpa_set`, `xpa_set_image` and `xpa_set_file`
+     with keyword `conn` instead of the connection shared by all XPA
+     commands.  Keyword `method` specifies the transport used by this
+     connection: "local" (or "unix") for unix sockets, "localhost" or "inet"
+     for TCP sockets; by default, the method given by the environment
+     variable XPA_METHOD is used.  On a single host, unix sockets are much
+     faster than TCP for big transfers.  Note that a server is reachable with
+     a given method only if it has registered its access points with this
+     method (see `xpa_fastest_method`).
+
+     A connection with a method is run by its own transfer process (see
+     `xpa_get`) which sets XPA_METHOD for itself before opening its
+     persistent connection, so the environment of Yorick is not modified.
+     Commands sent through such a connection are run by this transfer
+     process (keyword `lane` is then ignored) and their data are sent to it.
+
+     If access point(s) `apt` are specified, the connection is preconnected
+     to them: their servers are resolved by the name server and contacted
+     (with an XPA access check for both XPA get and XPA set commands) so
+     that the first real command sent through `conn` does not pay for the
+     connection.  Keyword `nmax` is the maximum number of servers to
+     preconnect per access point and access type (1 by default, -1 for all
+     matching servers as for `xpa_get`).  More access points may be
+     preconnected later by `conn(apt)` which yields the number of servers
+     reached.  Preconnecting is useful to warm up a connection before a time
+     critical sequence or to keep separate persistent connections for slow
+     and fast servers.
+
+     The connection is automatically closed when `conn` is no longer used,
+     the subroutine `xpa_close` may be called to close it explicitly.
+     Members `conn.method` and `conn.open` yield the method of the connection
+     and whether it is open.  Member `conn.apts` yields the preconnected
+     access points.  Calling `conn()`
+     checks all the preconnected access points again and yields whether the
+     connection is open and all their servers resolved by the name server
+     (up to `nmax` per access point) are reachable, which also keeps idle
+     connections alive.  Members never communicate with the servers.
+
+   SEE ALSO xpa_get, xpa_set, xpa_fastest_method.
+ */
+
+func xpa_fastest_method(apt, cmd, data, methods=, reps=, quiet=)
+/* DOCUMENT method = xpa_fastest_method(apt [, cmd [, data]]);
+
+     Measures the mean duration of XPA commands with access point `apt` for
+     different transport methods and yields the fastest method (a string
+     suitable for keyword `method` of `xpa_open`, nil if the access point is
+     not reachable).  If `data` is specified, XPA set commands sending `data`
+     with command `cmd` are timed; otherwise XPA get commands with command
+     `cmd` are timed.  Use data of the typical size to select the transport
+     for big transfers.
+
+     Keyword `methods` specifies the methods to compare (by default
+     `["local", "localhost", "inet"]`).  Keyword `reps` specifies the number
+     of commands to time for each method (10 by default).  Unless keyword
+     `quiet` is true, the results are printed.
 
-   SEE ALSO xpa_get.
+   SEE ALSO xpa_open.
  */
 {
-    ans = xpa_get("xpans");
-    n = ans.replies;
-    if (ans.errors > 0) {
-        for (i = 1; i <= n; ++i) {
-            if (ans(i,0) == 2) {
-                write, format="%s\n", ans(i,);
+    if (is_void(methods)) methods = ["local", "localhost", "inet"];
+    if (is_void(reps)) reps = 10;
+    best = [];
+    tbest = -1.0;
+    for (i = 1; i <= numberof(methods); ++i) {
+        conn = xpa_open(method=methods(i));
+        ans = (is_void(data) ? xpa_get(apt, cmd, conn=conn) :
+               xpa_set(apt, cmd, data, conn=conn));
+        if (ans() < 1 || ans.errors > 0) {
+            if (! quiet) {
+                write, format="  %-10s unreachable\n", methods(i);
             }
+            continue;
+        }
+        /* `timer, t1` adds the time elapsed since the previous call. */
+        t0 = t1 = array(double, 3);
+        timer, t0;
+        for (k = 1; k <= reps; ++k) {
+            ans = (is_void(data) ? xpa_get(apt, cmd, conn=conn) :
+                   xpa_set(apt, cmd, data, conn=conn));
+        }
+        timer, t1;
+        t = t1(3)/reps;
+        if (! quiet) {
+            write, format="  %-10s %12.3f ms per command\n", methods(i), 1e3*t;
+        }
+        if (tbest < 0.0 || t < tbest) {
+            best = methods(i);
+            tbest = t;
         }
-        error, "there are errors in XPA answers";
     }
-    lst = [];
-    if (ans.buffers > 0) {
-        for (i = 1; i <= n; ++i) {
-            buf = ans(i,3);
-            if (! is_void(buf)) {
-                j = where(buf == '\n');
-                if (is_array(j)) {
-                    buf(j) = '\0';
-                }
-                grow, lst, strchar(buf);
-            }
+    return best;
+}
+
+struct XPAResolverStats {
+    long enabled;  // whether the cache is enabled
+    long entries;  // number of cached addresses
+    long hits;     // number of commands using a cached address
+    long misses;   // number of name server lookups
+    long failures; // number of cached addresses invalidated by a failure
+}
+
+func xpa_resolver(enable, reset)
+/* DOCUMENT xpa_resolver, enable [, reset];
+         or stats = xpa_resolver();
+
+     The subroutine `xpa_resolver` enables or disables the cache of resolved
+     access points (disabled by default).  When enabled, an access point
+     template (like "ds9" or "DS9:*") used by `xpa_get` or `xpa_set` with a
+     single recipient (`nmax=1`, the default) and matching a single server is
+     resolved once by the XPA name server and the address of the server is
+     directly used by subsequent commands, saving a name server lookup per
+     command.  A cached address is forgotten whenever a command using it
+     fails (no replies or an error reply) so that it is resolved again by
+     the next command.  If `reset` is true, the cache is emptied and its
+     counters are reset.
+
+     When called as a function, `xpa_resolver` yields an `XPAResolverStats`
+     structure whose members are:
+
+       enabled   whether the cache is enabled;
+       entries   the number of cached addresses;
+       hits      the number of commands using a cached address;
+       misses    the number of name server lookups;
+       failures  the number of cached addresses invalidated by a failure.
+
+   SEE ALSO xpa_get, xpa_set, xpa_servers.
+ */
+{
+    s = _xpa_resolver(enable, reset);
+    if (am_subroutine()) return;
+    stats = XPAResolverStats();
+    stats.enabled = s(1);
+    stats.entries = s(2);
+    stats.hits = s(3);
+    stats.misses = s(4);
+    stats.failures = s(5);
+    return stats;
+}
+
+extern _xpa_resolver;
+/* DOCUMENT s = _xpa_resolver(enable, reset);
+
+     Private function to configure the cache of resolved access points and
+     to retrieve its counters as a vector of integers.
+
+   SEE ALSO xpa_resolver.
+ */
+
+extern xpa_set_image;
+/* DOCUMENT ans = xpa_set_image(apt, cmd, img);
+
+     This function sends the image `img` (a numerical array of any
+     non-complex type) to the XPA server(s) identified by `apt` (typically
+     SAOImage/ds9).  The bitpix, the dimensions and the byte order of the
+     data are inferred from the image.
+
+     By default, an "array" command is sent (see ds9 documentation) with the
+     image data in the native byte order, the image data are directly sent
+     without any copy.  The image can have 1 to 3 dimensions.
+
+     If keyword `fits` is set true, a FITS file is sent (with a "fits"
+     command).  The FITS header, the data (in big endian byte order) and the
+     padding are produced on the fly, by chunks, and sent in a single
+     transfer without building a concatenated copy of the file.
+
+     Optional argument `cmd` is the command to send; if it is nil, "array" or
+     "fits" is assumed depending on keyword `fits`.  In "array" mode, the
+     array description (e.g. "[xdim=640,ydim=480,bitpix=16,...]") is
+     appended to `cmd`.  Other arguments, keywords `nmax`, `lane`, `ack`,
+     `doxpa` and `verify` and the returned object are the same as for
+     `xpa_set`.  With `lane="bulk"`, the image is sent by a transfer process
+     of the bulk lane.
+
+     For instance:
+
+       xpa_check, xpa_set_image("ds9", , img);
+       xpa_check, xpa_set_image("ds9", "array new", img);
+
+   SEE ALSO xpa_set, xpa_check.
+ */
+
+extern xpa_get_into;
+/* DOCUMENT ans = xpa_get_into(apt, cmd, arr);
+
+     This function performs an XPA get command with a single recipient and
+     directly writes the received data into the numerical array `arr` whose
+     size (in bytes) must match that of the data.  Arguments `apt` and `cmd`
+     are the access point and the command as for `xpa_get`.  The data are
+     streamed by XPAGetFd into a pipe which is read by another thread
+     directly into `arr`, so no intermediate buffer nor file is needed for
+     the data.  This is intended for repeatedly retrieving data of known
+     size (e.g. polling camera frames).
+
+     The returned object is similar to that of `xpa_get` except that the data
+     are not stored in memory: `ans(1,)` yields the number of bytes written
+     into `arr`.  An error is thrown if the size of the received data does not
+     match that of `arr` (unless no data have been received, for instance
+     because the server replied an error); as the data are streamed, `arr`
+     may then have been partially overwritten.
+
+     Keywords `lane` and `timeout` are the same as for `xpa_get`, with
+     `lane="bulk"` the data are received by a transfer process and read from
+     its socket directly into `arr` (after having checked their size).
+
+   SEE ALSO xpa_get, xpa_array.
+ */
+
+extern xpa_get_fd;
+/* DOCUMENT ans = xpa_get_fd(apt, cmd, dest);
+
+     This function performs an XPA get command and directly writes the data
+     received from each recipient to a file.  Arguments `apt` and `cmd` are
+     the access point and the command as for `xpa_get`.  Argument `dest`
+     specifies the destination: a file name or a file descriptor (an integer
+     such as 1 for the standard output).  If keyword `nmax` is specified,
+     `dest` must be an array with one destination per recipient (with
+     `nmax=-1`, there must be as many destinations as matching access
+     points).  Named files are created or truncated, file descriptors are
+     left open.
+
+     The data are written to the destinations by XPAGetFd (regular files
+     directly, other destinations such as pipes or terminals through a pipe
+     copied by another thread), so the memory used does not depend on the
+     size of the data.  The returned object is similar to that of `xpa_get`
+     except that the data are not stored in memory: `ans(i,)` yields the
+     number of bytes written for the `i`-th reply, whatever the kind of
+     destination.  A failure to write to a destination is reported as an
+     error message of the reply.
+
+     Keyword `lane` is the same as for `xpa_get`, with `lane="bulk"` the data
+     are received by a transfer process which writes them to the
+     destinations and sends back the number of bytes written.
+
+     For instance, to save the current ds9 image:
+
+       ans = xpa_get_fd("ds9", "fits", "image.fits");
+       xpa_check, ans;
+
+   SEE ALSO xpa_get, xpa_get_into, xpa_check.
+ */
+
+extern xpa_set_file;
+/* DOCUMENT ans = xpa_set_file(apt, cmd, path);
+
+     This function performs an XPA set command sending the contents of the
+     file `path` to the recipients.  The file is mapped in memory (with
+     `mmap`) so its contents need not be loaded by Yorick.  Keywords `offset`
+     and `length` may be used to specify the offset (in bytes) of the part of
+     the file to send and its length (in bytes); by default, the whole file
+     is sent.  Other arguments, keywords `nmax`, `lane`, `ack`, `doxpa` and
+     `verify` and the returned object are the same as for `xpa_set`.  With
+     `lane="bulk"`, the file is passed to a transfer process of the bulk lane
+     which maps it itself.
+
+     For instance, to display an archived FITS file with ds9:
+
+       xpa_check, xpa_set_file("ds9", "fits", "cube.fits");
+
+   SEE ALSO xpa_set, xpa_get_fd.
+ */
+
+struct XPALane {
+    string name;      // name of the lane
+    long   running;   // number of running commands
+    long   queued;    // number of queued commands
+    long   completed; // number of completed commands
+    long   max;       // maximum number of transfer processes
+    long   procs;     // number of transfer processes (busy or idle)
+}
+
+func xpa_lanes(nbulk)
+/* DOCUMENT xpa_lanes, nbulk;
+         or stats = xpa_lanes();
+
+     The subroutine `xpa_lanes` sets the maximum number of transfer
+     processes `nbulk` of the bulk lane (2 by default), this bounds the
+     number of bulk transfers run concurrently, other bulk commands waiting
+     in a queue.  The control lane may run up to 32 transfer processes, this
+     is also the maximum number of access points served concurrently by a
+     fan-out (see `xpa_get`).
+
+     When called as a function, `xpa_lanes` yields an array of 2 `XPALane`
+     structures, one for the "control" lane and one for the "bulk" lane,
+     whose members are:
+
+       name       the name of the lane;
+       running    the number of running commands;
+       queued     the number of queued commands;
+       completed  the number of completed commands;
+       max        the maximum number of transfer processes;
+       procs      the number of transfer processes (busy or idle), they are
+                  kept between commands.
+
+   SEE ALSO xpa_get, xpa_set, xpa_get_async.
+ */
+{
+    s = _xpa_lanes(nbulk);
+    if (am_subroutine()) return;
+    stats = array(XPALane, 2);
+    stats.name = ["control", "bulk"];
+    stats.running = s(1,);
+    stats.queued = s(2,);
+    stats.completed = s(3,);
+    stats.max = s(4,);
+    stats.procs = s(5,);
+    return stats;
+}
+
+extern _xpa_lanes;
+/* DOCUMENT s = _xpa_lanes(nbulk);
+
+     Private function to configure the bulk lane and to retrieve the
+     counters of the lanes as a 5-by-2 array of integers.
+
+   SEE ALSO xpa_lanes.
+ */
+
+local xpa_get_async, xpa_set_async;
+/* DOCUMENT req = xpa_get_async(apt [, cmd]);
+         or req = xpa_set_async(apt [, cmd [, arr]]);
+
+     These functions are non-blocking variants of `xpa_get` and `xpa_set`.
+     They take the same arguments and keywords but immediately return a
+     pending request `req` while the XPA command is run in the background by
+     a transfer process (see `xpa_get`).  The request can be used as
+     follows:
+
+       req.ready  yields whether the request has completed;
+       req()      waits for the request to complete and yields the XPA
+                  answer (see `xpa_get`).
+
+     Keyword `callback` may be set with a function to call as:
+
+       callback, ans;
+
+     when the request completes, `ans` being the XPA answer.  Completion is
+     signaled by the socket of the transfer process to the event loop of Yorick
+     (no polling), so the interpreter prompt and other timers keep running
+     meanwhile.
+
+     For `xpa_set_async`, the array `arr` (if any) is not copied and must not
+     be modified until the request has started (its contents are then sent to
+     the transfer process); to be safe, wait until the request has
+     completed.  Discarding a request which
+     has not yet started cancels it, discarding a running request lets it
+     complete in the background without waiting.
+
+     Keyword `lane` selects the pool of transfer processes which runs the
+     request: "control" (the default) or "bulk" (see `xpa_get`).  Keywords
+     `ack`, `doxpa` and `verify` are as for `xpa_get` (keyword `timeout` is
+     not supported as `req.ready` can be polled instead).
+
+   SEE ALSO xpa_get, xpa_set, xpa_lanes, after.
+ */
+func xpa_get_async(apt, cmd, nmax=, lane=, ack=, doxpa=, verify=, callback=)
+{
+    req = _xpa_get_async(apt, cmd, nmax=nmax, lane=lane, ack=ack,
+                         doxpa=doxpa, verify=verify);
+    if (! is_void(callback)) _xpa_async_watch, req, callback;
+    return req;
+}
+
+func xpa_set_async(apt, cmd, arr, nmax=, lane=, ack=, doxpa=, verify=,
+                   callback=)
+{
+    req = _xpa_set_async(apt, cmd, arr, nmax=nmax, lane=lane, ack=ack,
+                         doxpa=doxpa, verify=verify);
+    if (! is_void(callback)) _xpa_async_watch, req, callback;
+    return req;
+}
+
+func _xpa_async_done
+{
+    local callback;
+    req = _xpa_async_next(callback);
+    if (! is_void(req)) callback, req();
+}
+
+extern _xpa_get_async;
+extern _xpa_set_async;
+/* DOCUMENT req = _xpa_get_async(apt, cmd);
+         or req = _xpa_set_async(apt, cmd, arr);
+
+     Private functions to start asynchronous XPA commands.
+
+   SEE ALSO xpa_get_async, xpa_set_async.
+ */
+
+extern _xpa_async_watch;
+extern _xpa_async_next;
+/* DOCUMENT _xpa_async_watch, req, callback;
+         or req = _xpa_async_next(callback);
+
+     Private functions to call `callback` when the asynchronous request `req`
+     completes.  When a watched request completes, a call to
+     `_xpa_async_done` is queued and `_xpa_async_next` yields the next
+     completed request (nil if none) and stores its callback in `callback`.
+
+   SEE ALSO xpa_get_async, xpa_set_async.
+ */
+
+func xpa_server(apt, send, recv, help=)
+/* DOCUMENT srv = xpa_server(apt, send, recv);
+
+     Registers an XPA access point served by Yorick so that other programs
+     (e.g. `xpaget` and `xpaset` in a shell, ds9 scripts or other Yorick
+     sessions) can retrieve or send data from/to the running session.
+     Argument `apt` is the name of the access point as "class:name" (class
+     "YORICK" is assumed if not specified).  Arguments `send` and `recv` are
+     the Yorick functions (or nil) called to serve XPA get and XPA set
+     requests:
+
+       func send(params) { ...; return data; }
+       func recv(params, data) { ... }
+
+     where `params` is the command (a string) sent by the client.  The value
+     returned by `send` is sent to the client: a numerical array is sent as
+     its raw contents, a string array as lines of text, nothing is sent if it
+     is nil.  For `recv`, `data` is the received data as an array of bytes
+     (or nil if no data were sent).  Errors raised by the handlers are
+     reported to the client as XPA error messages.  Keyword `help` may be set
+     with a help string for the access point.
+
+     The access point exists as long as the returned object `srv` is in use.
+     Its members `srv.name`, `srv.gets` and `srv.sets` yield the full name of
+     the access point and the number of get and set requests served so far.
+
+     The sockets of the access points are watched by the event loop of
+     Yorick, so requests are served as soon as they arrive while the
+     interpreter is idle and serving never blocks the interpreter prompt (a
+     long computation delays the requests until it returns, see
+     `xpa_serve`).  While Yorick serves access points, its own XPA commands
+     are run with `doxpa=false` (whatever the keyword `doxpa`) so that no
+     handler is called in the middle of them.  A Yorick session must not
+     send XPA requests to its own access points as they cannot be served
+     before the request completes.
+
+   SEE ALSO xpa_get, xpa_set, xpa_publish, xpa_serve.
+ */
+{
+    return _xpa_server(apt, send, recv, help);
+}
+
+func xpa_publish(srv, arr, help=, snapshot=)
+/* DOCUMENT srv = xpa_publish(apt, arr);
+         or xpa_publish, srv, arr;
+
+     Publishes the numerical array `arr` through an XPA access point served
+     by Yorick: XPA get requests to the access point receive the contents of
+     the array.  The first form creates a new access point named `apt` (see
+     `xpa_server`) and yields the server object, the second form binds
+     another array to the existing server `srv`.
+
+     The memory of the published array is directly sent to the clients
+     without any copy and the array is kept in use while published so that
+     its data cannot be freed.  Modifying the elements of the array in place
+     (e.g. `arr(..) = next_frame`) is thus immediately visible by the clients
+     while assigning a new value to the variable `arr` is not (call
+     `xpa_publish` again).  If keyword `snapshot` is true, a private copy of
+     `arr` is published instead so that the published data are not affected
+     by subsequent changes of `arr`.  A scalar is always copied.
+
+     Member `srv.version` yields the number of times data have been published
+     (i.e. it is incremented by each call to `xpa_publish`).  Keyword `help`
+     may be used to specify a help string when the access point is created.
+
+   SEE ALSO xpa_server.
+ */
+{
+    return _xpa_publish(srv, arr, help, snapshot);
+}
+
+func xpa_receive(apt, .., help=)
+/* DOCUMENT srv = xpa_receive(apt, arr1, arr2, ...);
+
+     Creates an XPA access point named `apt` (see `xpa_server`) whose XPA set
+     requests are directly written into the preregistered arrays `arr1`,
+     `arr2`, etc.  These arrays must have the same numerical type and shape
+     and are filled in turn (as a ring buffer) by successive requests, so
+     that receiving data requires no allocation.  The data sent by the client
+     must have exactly the size of the arrays, otherwise an error is reported
+     to the client (and the contents of the target array is undefined).
+
+     The server object `srv` has the following members and behavior:
+
+       srv.seq    yields the number of data received so far;
+       srv.slot   yields the index of the last filled array (0 if none);
+       srv.slots  yields the number of receiving arrays;
+       srv(k)     yields the `k`-th receiving array;
+       srv()      yields the last filled array (nil if none).
+
+     The receiving arrays are the arrays passed to `xpa_receive` (not
+     copies), they are kept in use by the server.  For instance:
+
+       a = array(short, 512, 512);
+       b = array(short, 512, 512);
+       srv = xpa_receive("camera", a, b);
+
+     Keyword `help` may be set with a help string for the access point.
+
+   SEE ALSO xpa_server, xpa_publish.
+ */
+{
+    if (! more_args()) error, "expecting at least one receiving array";
+    srv = _xpa_receive(apt, help, next_arg());
+    while (more_args()) {
+        _xpa_receive, srv, , next_arg();
+    }
+    return srv;
+}
+
+func _xpa_server_dispatch(recv)
+{
+    extern _xpa_server_func, _xpa_server_params, _xpa_server_data;
+    extern _xpa_server_result, _xpa_server_error;
+    if (catch(-1)) {
+        _xpa_server_error = catch_message;
+        return;
+    }
+    handler = _xpa_server_func;
+    if (recv) {
+        handler, _xpa_server_params, _xpa_server_data;
+    } else {
+        _xpa_server_result = handler(_xpa_server_params);
+    }
+}
+
+extern xpa_serve;
+/* DOCUMENT xpa_serve, secs;
+         or xpa_serve;
+
+     Serves the requests to the access points of Yorick (see `xpa_server`,
+     `xpa_publish` and `xpa_receive`) for `secs` seconds, or until there are
+     no more such access points if `secs` is not specified.  This is useful
+     for scripts running in batch mode where requests cannot be served in
+     the background.  The call can be interrupted by Control-C.
+
+   SEE ALSO xpa_server.
+ */
+
+extern _xpa_server;
+extern _xpa_publish;
+extern _xpa_receive;
+extern _xpa_poll;
+/* DOCUMENT srv = _xpa_server(apt, send, recv, help);
+         or srv = _xpa_publish(apt_or_srv, arr, help, snapshot);
+         or srv = _xpa_receive(apt_or_srv, help, arr);
+         or n = _xpa_poll();
+
+     Private functions to register an XPA access point, to publish an array,
+     to add an array receiving data and to serve pending requests
+     (`_xpa_poll` is called when the event loop of Yorick detects a request
+     and yields the number of access points served by Yorick).
+
+   SEE ALSO xpa_server, xpa_publish, xpa_receive.
+ */
+
+struct XPAStats {
+    string apt;       // access point(s)
+    string cmd;       // command
+    long   calls;     // number of calls
+    long   errors;    // number of error replies
+    long   replies;   // number of replies
+    long   bytes_in;  // number of bytes received
+    long   bytes_out; // number of bytes sent
+    double tmin;      // minimum duration of calls (s)
+    double tmean;     // mean duration of calls (s)
+    double tmax;      // maximum duration of calls (s)
+    double t50;       // median duration of calls (s)
+    double t90;       // 90th percentile of duration of calls (s)
+    double t99;       // 99th percentile of duration of calls (s)
+    double parse;     // mean time spent parsing arguments (s)
+    double connect;   // mean time spent connecting (s)
+    double transfer;  // mean time spent in XPA transfers (s)
+    double push;      // mean time spent building the result (s)
+}
+
+func xpa_stats(enable=, reset=)
+/* DOCUMENT xpa_stats, enable=1;
+         or stats = xpa_stats();
+         or xpa_stats;
+         or xpa_stats, reset=1;
+
+     Manages the statistics about the calls to `xpa_get` and `xpa_set`.
+     Collecting statistics is disabled by default and is enabled (or
+     disabled) by setting keyword `enable` true (or false).  When disabled,
+     the overhead is negligible.  Keyword `reset` may be set true to discard
+     all collected statistics.
+
+     When called as a function, an array of `XPAStats` structures is returned
+     with one entry per access point and command (nil if there are none); the
+     members are:
+
+       apt, cmd             the access point and the command (fan-out calls
+                            are accounted under the comma separated list of
+                            access points);
+       calls, errors        the number of calls and of error replies;
+       replies              the number of replies;
+       bytes_in, bytes_out  the number of bytes received and sent;
+       tmin, tmean, tmax    the minimum, mean and maximum duration of calls;
+       t50, t90, t99        the 50th, 90th and 99th percentiles of the
+                            duration of calls (with a relative precision of
+                            about 6%);
+       parse, connect,      the mean time spent parsing arguments, connecting
+       transfer, push       (and resolving `nmax=-1`), in the XPA transfer
+                            and building the result.
+
+     All durations are in seconds.  When called as a subroutine without
+     keywords, the statistics are printed.
+
+   SEE ALSO xpa_get, xpa_set, xpa_latency.
+ */
+{
+    _xpa_stats_config, enable, reset;
+    if (! am_subroutine()) {
+        local apts, cmds, counts, times;
+        n = _xpa_stats(apts, cmds, counts, times);
+        if (n < 1) return;
+        stats = array(XPAStats, n);
+        stats.apt = apts;
+        stats.cmd = cmds;
+        stats.calls = counts(1,);
+        stats.errors = counts(2,);
+        stats.replies = counts(3,);
+        stats.bytes_in = counts(4,);
+        stats.bytes_out = counts(5,);
+        stats.tmin = times(1,);
+        stats.tmean = times(2,);
+        stats.tmax = times(3,);
+        stats.t50 = times(4,);
+        stats.t90 = times(5,);
+        stats.t99 = times(6,);
+        stats.parse = times(7,);
+        stats.connect = times(8,);
+        stats.transfer = times(9,);
+        stats.push = times(10,);
+        return stats;
+    }
+    if (is_void(enable) && is_void(reset)) {
+        stats = xpa_stats();
+        write, format="%-24s %-16s %8s %6s %10s %10s %10s %10s\n",
+            "ACCESS POINT", "COMMAND", "CALLS", "ERRORS",
+            "MEAN (ms)", "P50 (ms)", "P99 (ms)", "MAX (ms)";
+        for (i = 1; i <= numberof(stats); ++i) {
+            s = stats(i);
+            write, format="%-24s %-16s %8d %6d %10.3f %10.3f %10.3f %10.3f\n",
+                s.apt, s.cmd, s.calls, s.errors, 1e3*s.tmean, 1e3*s.t50,
+                1e3*s.t99, 1e3*s.tmax;
         }
     }
+}
+
+extern xpa_latency;
+/* DOCUMENT q = xpa_latency(apt, hist, bnds);
+         or list = xpa_latency();
+
+     Yields the tail latency of the XPA transfers with access point `apt` as
+     `q = [p50, p99, p999]`, the 50th, 99th and 99.9th percentiles of the
+     duration (in seconds) of the XPA transfers (zero if there are none).
+     The durations of all transfers (including those performed by transfer
+     processes for fan-out and asynchronous requests, and by the background
+     sender queue) are always accounted, whether statistics are enabled by
+     `xpa_stats` or not, in a fixed size log-bucketed histogram per access
+     point.  Percentiles have a relative precision of about 6% whatever the
+     number of transfers.  There are histograms for 64 access points, the
+     transfers with further access points are accounted together under the
+     name "(other)".
+
+     Optional output variable `hist` is set with the raw counts of the
+     histogram buckets and optional output variable `bnds` with the bounds
+     of the buckets (in seconds, bucket `k` counts the durations between
+     `bnds(k)` and `bnds(k+1)`, the first one also counts the shorter
+     durations and the last one the longer durations).
+
+     When called without arguments, the list of access points for which
+     durations have been accounted is returned.  The histograms are cleared
+     by `xpa_stats, reset=1`.
+
+   SEE ALSO xpa_stats.
+ */
+
+struct XPATrace {
+    double start;    // start time (seconds since the Epoch)
+    double duration; // duration of the call (s)
+    string apt;      // access point(s)
+    string cmd;      // command
+    long   set;      // 1 for xpa_set, 0 for xpa_get
+    long   size;     // number of bytes sent or received
+    long   replies;  // number of replies
+    long   errors;   // number of error replies
+}
+
+func xpa_trace(size)
+/* DOCUMENT xpa_trace, size;
+         or log = xpa_trace();
+
+     Manages the trace log of the calls to `xpa_get` and `xpa_set`.  The
+     trace log is a ring buffer which records the last `size` calls; it is
+     disabled by default and is (re)created and emptied by `xpa_trace, size`
+     (`size=0` disables it).
+
+     When called as a function, the recorded calls are returned (oldest
+     first) as an array of `XPATrace` structures (nil if there are none) with
+     members:
+
+       start, duration   the start time (in seconds since the Epoch) and
+                         duration (in seconds) of the call;
+       apt, cmd          the access point(s) and the command (truncated to
+                         63 characters);
+       set               1 for `xpa_set`, 0 for `xpa_get`;
+       size              the number of bytes sent or received;
+       replies, errors   the number of replies and of error replies.
+
+     The subroutine `xpa_trace_save` saves the trace log in a JSON file in the
+     Chrome trace event format which can be loaded by `chrome://tracing` or
+     Perfetto for offline analysis:
+
+       xpa_trace_save, "xpa-trace.json";
+
+   SEE ALSO xpa_stats.
+ */
+{
+    if (! is_void(size)) {
+        _xpa_trace_config, size;
+    }
+    if (! am_subroutine()) {
+        local times, names, counts;
+        n = _xpa_trace(times, names, counts);
+        if (n < 1) return;
+        log = array(XPATrace, n);
+        log.start = times(1,);
+        log.duration = times(2,);
+        log.apt = names(1,);
+        log.cmd = names(2,);
+        log.set = counts(1,);
+        log.size = counts(2,);
+        log.replies = counts(3,);
+        log.errors = counts(4,);
+        return log;
+    }
+}
+
+extern xpa_trace_save;
+extern _xpa_trace_config;
+extern _xpa_trace;
+/* DOCUMENT xpa_trace_save, filename;
+         or size = _xpa_trace_config(size);
+         or n = _xpa_trace(times, names, counts);
+
+     The subroutine `xpa_trace_save` saves the trace log in a file with the
+     Chrome trace event format.  The other functions are private.
+
+   SEE ALSO xpa_trace.
+ */
+
+extern xpa_capture;
+extern xpa_replay;
+/* DOCUMENT xpa_capture, filename;
+         or xpa_capture;
+         or res = xpa_replay(filename [, apt]);
+
+     The subroutine `xpa_capture` starts capturing the calls to `xpa_get` and
+     `xpa_set` in the binary file `filename` (which is created or
+     overwritten).  Capturing stops when `xpa_capture` is called again (with
+     another file name or without arguments).  When called as a function,
+     `xpa_capture` yields the number of calls captured in the previous file.
+     For each call, the access point, the command, the data sent, the start
+     time and the duration of the call, the number of replies and of errors
+     and the total size of the received data are recorded.  Fan-out calls
+     are recorded as one call per access point.
+
+     The function `xpa_replay` replays the calls captured in `filename` and
+     yields an array of results:
+
+       res(1)   number of calls;
+       res(2)   number of error replies;
+       res(3)   number of calls whose replies differ from the captured ones
+                (number of replies or size of received data);
+       res(4)   total elapsed time (s);
+       res(5)   number of bytes sent and received;
+       res(6)   throughput (bytes per second);
+       res(7)   mean latency of calls (s);
+       res(8)   median latency of calls (s);
+       res(9)   99th percentile of latency of calls (s);
+       res(10)  maximum latency of calls (s).
+
+     If `apt` is specified, all calls are sent to this access point (e.g. a
+     local ds9 or a stand-in server) instead of the captured ones.  Keyword
+     `speed` specifies the replay speed relative to the original timing of
+     the calls: `speed=1` (the default) reproduces the original timing,
+     `speed=N` replays N times faster and `speed=0` replays the calls as fast
+     as possible.
+
+     Captured files use the native byte order of the machine and can only be
+     replayed on machines with the same byte order.
+
+   SEE ALSO xpa_get, xpa_set, xpa_trace.
+ */
+
+extern _xpa_stats_config;
+extern _xpa_stats;
+/* DOCUMENT _xpa_stats_config, enable, reset;
+         or n = _xpa_stats(apts, cmds, counts, times);
+
+     Private functions to configure and retrieve the statistics about XPA
+     calls.
+
+   SEE ALSO xpa_stats.
+ */
+
+extern xpa_queue_set;
+extern xpa_queue_config;
+extern xpa_queue_flush;
+/* DOCUMENT xpa_queue_set, apt [, cmd [, arr]];
+         or xpa_queue_config, size, policy;
+         or stats = xpa_queue_stats();
+         or xpa_queue_flush;
+
+     The subroutine `xpa_queue_set` queues an XPA set command which is sent
+     in the background by a dedicated long-lived transfer process (see
+     `xpa_get`) and returns immediately.  The arguments and keywords `nmax`, `ack`, `doxpa` and
+     `verify` are the same as for `xpa_set`.  The data `arr` is copied so
+     the caller may immediately reuse its array.  The replies of the
+     recipients are discarded, only the number of errors is recorded.
+
+     The subroutine `xpa_queue_config` sets the maximum number `size` of
+     queued commands (16 by default) and the `policy` applied when a command
+     is queued while the queue is full:
+
+       "block"     wait until there is room in the queue (the default);
+       "drop"      drop the oldest queued command;
+       "coalesce"  replace the queued command, if any, having the same access
+                   point and the same command (the new command takes its
+                   place in the queue), drop the oldest queued command
+                   otherwise.
+
+     Any of `size` or `policy` may be nil to keep its current setting.
+
+     The function `xpa_queue_stats` yields the statistics of the queue (see
+     `XPAQueueStats`).
+
+     The subroutine `xpa_queue_flush` waits until all queued commands have
+     been sent.  Commands still queued when Yorick exits are not sent, their
+     number is printed on the standard error output.
+
+   SEE ALSO xpa_set, xpa_set_async.
+ */
+
+struct XPAQueueStats {
+    long   accepted; // number of commands accepted in the queue
+    long   sent;     // number of commands sent
+    long   dropped;  // number of commands dropped
+    long   errors;   // number of error replies
+    long   pending;  // number of commands not yet sent
+    long   size;     // queue size
+    string policy;   // queue policy
+}
+
+func xpa_queue_stats
+/* DOCUMENT stats = xpa_queue_stats();
+
+     Yields an `XPAQueueStats` structure with the statistics of the queue of
+     `xpa_queue_set` whose members are:
+
+       accepted  the number of commands accepted in the queue;
+       sent      the number of commands sent;
+       dropped   the number of commands dropped;
+       errors    the number of error replies;
+       pending   the number of commands not yet sent;
+       size      the queue size;
+       policy    the queue policy ("block", "drop" or "coalesce").
+
+   SEE ALSO xpa_queue_set, xpa_queue_config.
+ */
+{
+    s = _xpa_queue_stats();
+    stats = XPAQueueStats();
+    stats.accepted = s(1);
+    stats.sent = s(2);
+    stats.dropped = s(3);
+    stats.errors = s(4);
+    stats.pending = s(5);
+    stats.size = s(6);
+    stats.policy = ["block", "drop", "coalesce"](s(7) + 1);
+    return stats;
+}
+
+extern _xpa_queue_stats;
+/* DOCUMENT s = _xpa_queue_stats();
+
+     Private function to retrieve the statistics of the queue of
+     `xpa_queue_set` as a vector of integers.
+
+   SEE ALSO xpa_queue_stats.
+ */
+
+func xpa_list(apt, ttl=)
+/* DOCUMENT lst = xpa_list();
+         or xpa_list;
+         or lst = xpa_list(apt, ttl=secs);
+
+     This function retrieves a list of the current XPA servers.  If called as a
+     function, a list of strings (or nil if there are no servers) is returned;
+     otherwise the list of servers is printed.  Optional argument `apt` is an
+     XPA template (like "DS9:*") to only list the matching access points.
+     Keyword `ttl` is as for `xpa_servers`.
+
+   SEE ALSO xpa_get, xpa_servers.
+ */
+{
+    tbl = xpa_servers(apt, ttl=ttl);
+    if (is_void(tbl)) {
+        lst = [];
+    } else {
+        lst = tbl(1,) + " " + tbl(2,) + " " + tbl(3,) + " " + tbl(4,) +
+            " " + tbl(5,);
+    }
     if (am_subroutine()) {
-        write, format="%s\n", lst;
+        if (! is_void(lst)) {
+            write, format="%s\n", lst;
+        }
     } else {
         return lst;
     }
 }
 
+extern xpa_servers;
+/* DOCUMENT tbl = xpa_servers();
+         or tbl = xpa_servers(apt, ttl=secs);
+
+     yields the list of access points registered with the XPA name server as
+     a 5-by-N array of strings (or nil if there are none) whose rows are:
+
+       tbl(1,) = class of the access points;
+       tbl(2,) = name of the access points;
+       tbl(3,) = access type ("g" for get, "s" for set, "i" for info);
+       tbl(4,) = method (the transport address);
+       tbl(5,) = user owning the servers.
+
+     Optional argument `apt` is an XPA template ("class:name" or "name", with
+     shell-like wildcards) to only select the matching access points.
+
+     The parsed reply of the name server is cached.  If keyword `ttl` is
+     specified, the cached list is reused if it is younger than `ttl`
+     seconds; otherwise (the default) the name server is always queried.
+     Selecting access points in a loop with, say, `ttl=1` thus costs no name
+     server round trip.
+
+   SEE ALSO xpa_list.
+ */
+
 func xpa_array(ans, i, type, ..)
 /* DOCUMENT arr = xpa_array(ans, i, type, dims...);
 
@@ -160,6 +1145,32 @@ func xpa_array(ans, i, type, ..)
     return ans((is_void(i) ? 1 : i), array(type, dims));
 }
 
+extern xpa_fits;
+/* DOCUMENT arr = xpa_fits(ans, i, hdr);
+
+     decodes the `i`-th data buffer stored in XPA answer `ans` as a FITS file
+     and yields the primary image.  Index `i` is optional and defaults to the
+     first reply.  The type of the result is given by the BITPIX card (char,
+     short, int, long, float or double).  If the BSCALE or BZERO cards imply an
+     integer offset (e.g. unsigned integers), the result has the next larger
+     integer type; otherwise, scaled values are converted to float (for
+     BITPIX=-32) or double.  Decoding, byte swapping and scaling are done in a
+     single pass by compiled code.
+     The result is nil if the primary HDU has no data (NAXIS = 0).
+
+     If optional output variable `hdr` is specified, it is set with the header
+     cards (as an array of strings without trailing spaces).  If keyword `take`
+     is set true, the data buffer is released after decoding (afterwards
+     `ans(i,)` yields 0) so that the raw data and the decoded image do not
+     both remain in memory.
+
+     For instance, to retrieve the image currently displayed by ds9:
+
+       img = xpa_fits(xpa_get("ds9", "fits"), , hdr);
+
+   SEE ALSO xpa_get, xpa_array.
+ */
+
 local xpa_text, xpa_get_text, _xpa_text;
 /* DOCUMENT txt = xpa_text(ans);
          or txt = xpa_get_text(apt, cmd);
@@ -12,8 +12,28 @@
  */
 
 /* Standard C library headers. */
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <limits.h>
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <signal.h>
+
+/* POSIX headers. */
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
 
 /* XPA header. */
 #include <xpa.h>
@@ -67,12 +87,82 @@ push_string(const char* str, long len)
     ypush_q(NULL)[0] = cpy;
 }
 
+/* Yields the size of the elements of an array of given type (0 if not a
+   numerical type). */
+static size_t elem_size(int typeid)
+{
+    switch (typeid) {
+    case Y_CHAR: return sizeof(char);
+    case Y_SHORT: return sizeof(short);
+    case Y_INT: return sizeof(int);
+    case Y_LONG: return sizeof(long);
+    case Y_FLOAT: return sizeof(float);
+    case Y_DOUBLE: return sizeof(double);
+    case Y_COMPLEX: return 2*sizeof(double);
+    default: return 0;
+    }
+}
+
+/* Yields whether the machine is little endian. */
+static int little_endian()
+{
+    union {
+        unsigned int  i;
+        unsigned char c[sizeof(unsigned int)];
+    } u;
+    u.i = 1;
+    return (u.c[0] == 1);
+}
+
+/* Pushes a new numerical array of given type and dimensions and yields its
+   address. */
+static void* push_array(int typeid, long dims[])
+{
+    switch (typeid) {
+    case Y_CHAR: return ypush_c(dims);
+    case Y_SHORT: return ypush_s(dims);
+    case Y_INT: return ypush_i(dims);
+    case Y_LONG: return ypush_l(dims);
+    case Y_FLOAT: return ypush_f(dims);
+    case Y_DOUBLE: return ypush_d(dims);
+    case Y_COMPLEX: return ypush_z(dims);
+    default: y_error("invalid array type");
+    }
+    return NULL;
+}
+
+static long index_of_ack = -1;
+static long index_of_conn = -1;
+static long index_of_doxpa = -1;
+static long index_of_fits = -1;
+static long index_of_lane = -1;
+static long index_of_length = -1;
+static long index_of_method = -1;
 static long index_of_nmax = -1;
+static long index_of_offset = -1;
+static long index_of_speed = -1;
+static long index_of_take = -1;
+static long index_of_timeout = -1;
+static long index_of_ttl = -1;
+static long index_of_verify = -1;
 
 static void initialize_indices()
 {
 #define INIT(s) if (index_of_##s == -1) index_of_##s = yfind_global(#s, 0)
+    INIT(ack);
+    INIT(conn);
+    INIT(doxpa);
+    INIT(fits);
+    INIT(lane);
+    INIT(length);
+    INIT(method);
     INIT(nmax);
+    INIT(offset);
+    INIT(speed);
+    INIT(take);
+    INIT(timeout);
+    INIT(ttl);
+    INIT(verify);
 #undef INIT
 }
 
@@ -82,10 +172,10 @@ static void initialize_indices()
 static XPA client = NULL;
 static int atexit_called = 0; /* atexit(disconnect) has been called? */
 
-static void connect();
+static void connect_client();
 static void disconnect();
 
-static void connect()
+static void connect_client()
 {
     if (client == NULL) {
         client = XPAOpen(NULL);
@@ -112,16 +202,304 @@ static void disconnect()
     }
 }
 
+/*---------------------------------------------------------------------------*/
+/* CONNECTIONS */
+
+/* Besides the shared persistent connection, explicit connections can be
+   opened by `xpa_open` and used by XPA commands with keyword `conn`.  The
+   transport used by XPA (unix sockets or TCP) is given by the environment
+   variable XPA_METHOD.  A connection with a specific method is run by its
+   own transfer process which sets XPA_METHOD before opening its persistent
+   XPA handle, so the environment of Yorick is never modified.  A
+   connection may be preconnected to given access points so that the first
+   real command does not pay for the name server lookup and the connection
+   to the servers. */
+
+typedef struct xpaconn {
+    XPA    xpa;    /* XPA persistent client handle (NULL if closed or run by
+                      a transfer process) */
+    char*  method; /* XPA_METHOD for this connection (NULL for default) */
+    struct pool* pool; /* transfer process of a connection with a method
+                          (NULL if closed or none) */
+    char** apts;   /* preconnected access points */
+    int*   nmaxs;  /* maximum number of recipients of preconnected access
+                      points */
+    long   napts;  /* number of preconnected access points */
+} xpaconn_t;
+
+#define CONN_OPEN(obj) ((obj)->xpa != NULL || (obj)->pool != NULL)
+
+static int preconnect(xpaconn_t* obj, const char* apt, int nmax, int* alive);
+static struct pool* new_conn_pool(const char* method);
+static void unref_pool(struct pool* pool);
+
+/* Closes a connection. */
+static void close_xpaconn(xpaconn_t* obj)
+{
+    if (obj->xpa != NULL) {
+        XPA xpa = obj->xpa;
+        obj->xpa = NULL;
+        XPAClose(xpa);
+    }
+    if (obj->pool != NULL) {
+        struct pool* pool = obj->pool;
+        obj->pool = NULL;
+        unref_pool(pool);
+    }
+}
+
+static void free_xpaconn(void* addr)
+{
+    xpaconn_t* obj = (xpaconn_t*)addr;
+    long i;
+    close_xpaconn(obj);
+    free(obj->method);
+    for (i = 0; i < obj->napts; ++i) {
+        free(obj->apts[i]);
+    }
+    free(obj->apts);
+    free(obj->nmaxs);
+}
+
+/* Remembers that `obj` has been preconnected to `apt`. */
+static void add_preconnected(xpaconn_t* obj, const char* apt, int nmax)
+{
+    char** apts;
+    int* nmaxs;
+    long i;
+    for (i = 0; i < obj->napts; ++i) {
+        if (strcmp(obj->apts[i], apt) == 0) {
+            obj->nmaxs[i] = nmax;
+            return;
+        }
+    }
+    apts = (char**)realloc(obj->apts, (obj->napts + 1)*sizeof(char*));
+    if (apts != NULL) {
+        obj->apts = apts;
+        nmaxs = (int*)realloc(obj->nmaxs, (obj->napts + 1)*sizeof(int));
+        if (nmaxs != NULL) {
+            obj->nmaxs = nmaxs;
+            if ((apts[obj->napts] = strdup(apt)) != NULL) {
+                nmaxs[obj->napts] = nmax;
+                ++obj->napts;
+                return;
+            }
+        }
+    }
+    y_error("insufficient memory");
+}
+
+/* Yields whether all the servers of the preconnected access points of `obj`
+   are reachable. */
+static int alive_xpaconn(xpaconn_t* obj)
+{
+    long i;
+    int alive;
+    if (! CONN_OPEN(obj)) {
+        return 0;
+    }
+    for (i = 0; i < obj->napts; ++i) {
+        if (preconnect(obj, obj->apts[i], obj->nmaxs[i], &alive) < 0 ||
+            ! alive) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static void print_xpaconn(void* addr)
+{
+    xpaconn_t* obj = (xpaconn_t*)addr;
+    y_print("XPAConnection (method=", 0);
+    y_print(obj->method == NULL ? "default" : obj->method, 0);
+    y_print(CONN_OPEN(obj) ? ", open)" : ", closed)", 1);
+}
+
+static void extract_xpaconn(void* addr, char* name)
+{
+    xpaconn_t* obj = (xpaconn_t*)addr;
+    if (strcmp(name, "method") == 0) {
+        push_string(obj->method, -1);
+    } else if (strcmp(name, "open") == 0) {
+        ypush_int(CONN_OPEN(obj));
+    } else if (strcmp(name, "apts") == 0) {
+        if (obj->napts > 0) {
+            long dims[2];
+            char** list;
+            long i;
+            dims[0] = 1;
+            dims[1] = obj->napts;
+            list = ypush_q(dims);
+            for (i = 0; i < obj->napts; ++i) {
+                list[i] = p_strcpy(obj->apts[i]);
+            }
+        } else {
+            ypush_nil();
+        }
+    } else {
+        y_error("bad XPAConnection member");
+    }
+}
+
+/* Parses the `nmax` keyword of a preconnection. */
+static int get_nmax(int iarg)
+{
+    int typeid = yarg_typeid(iarg);
+    if (IS_INTEGER(typeid) && yarg_rank(iarg) == 0) {
+        long nmax = ygets_l(iarg);
+        if (nmax < -1 || nmax > INT_MAX) {
+            y_error("out of range value for keyword `nmax`");
+        }
+        return nmax;
+    } else if (! IS_VOID(typeid)) {
+        y_error("keyword `nmax` takes an integer value");
+    }
+    return 1;
+}
+
+/* Preconnects to access point(s) at `iarg` and yields the number of
+   reachable servers. */
+static long preconnect_args(xpaconn_t* obj, int iarg, int nmax)
+{
+    char** apts;
+    long i, napts, n = 0;
+    int k;
+    if (yarg_string(iarg) == 0) {
+        y_error("access point must be a string");
+    }
+    apts = ygeta_q(iarg, &napts, NULL);
+    for (i = 0; i < napts; ++i) {
+        if (apts[i] == NULL) {
+            y_error("access point must not be a null string");
+        }
+        add_preconnected(obj, apts[i], nmax);
+        k = preconnect(obj, apts[i], nmax, NULL);
+        n += (k > 0 ? k : 0);
+    }
+    return n;
+}
+
+static void eval_xpaconn(void* addr, int argc)
+{
+    xpaconn_t* obj = (xpaconn_t*)addr;
+    long index, n;
+    int iarg, apt = -1, nmax = 1;
+
+    for (iarg = argc - 1; iarg >= 0; --iarg) {
+        index = yarg_key(iarg);
+        if (index == -1) {
+            if (apt >= 0) {
+                y_error("expecting at most one access point argument");
+            }
+            apt = iarg;
+        } else {
+            --iarg;
+            if (index_of_nmax < 0) {
+                initialize_indices();
+            }
+            if (index == index_of_nmax) {
+                nmax = get_nmax(iarg);
+            } else {
+                y_error("unknown keyword");
+            }
+        }
+    }
+    if (! CONN_OPEN(obj)) {
+        y_error("XPA connection has been closed");
+    }
+    if (apt < 0 || yarg_nil(apt)) {
+        /* Check all preconnected access points. */
+        ypush_int(alive_xpaconn(obj));
+    } else {
+        n = preconnect_args(obj, apt, nmax);
+        ypush_long(n);
+    }
+}
+
+static y_userobj_t xpaconn_type = {
+    "XPAConnection",
+    free_xpaconn,
+    print_xpaconn,
+    eval_xpaconn,
+    extract_xpaconn,
+    NULL
+};
+
+void Y_xpa_open(int argc)
+{
+    xpaconn_t* obj;
+    const char* method = NULL;
+    long index;
+    int iarg, apt = -1, nmax = 1;
+
+    for (iarg = argc - 1; iarg >= 0; --iarg) {
+        index = yarg_key(iarg);
+        if (index == -1) {
+            if (apt >= 0) {
+                y_error("expecting at most one access point argument");
+            }
+            apt = iarg;
+        } else {
+            --iarg;
+            if (index_of_method < 0) {
+                initialize_indices();
+            }
+            if (index == index_of_method) {
+                if (! yarg_nil(iarg)) {
+                    method = ygets_q(iarg);
+                }
+            } else if (index == index_of_nmax) {
+                nmax = get_nmax(iarg);
+            } else {
+                y_error("unknown keyword");
+            }
+        }
+    }
+    obj = (xpaconn_t*)ypush_obj(&xpaconn_type, sizeof(xpaconn_t));
+    if (method != NULL && method[0] != '\0') {
+        obj->method = strdup(method);
+        if (obj->method == NULL) {
+            y_error("insufficient memory");
+        }
+        obj->pool = new_conn_pool(method);
+    } else {
+        obj->xpa = XPAOpen(NULL);
+        if (obj->xpa == NULL) {
+            y_error("failed to open XPA connection");
+        }
+    }
+    if (apt >= 0 && ! yarg_nil(apt + 1)) {
+        /* The new object has been pushed on top of the stack. */
+        preconnect_args(obj, apt + 1, nmax);
+    }
+}
+
+void Y_xpa_close(int argc)
+{
+    xpaconn_t* obj;
+
+    if (argc != 1) {
+        y_error("expecting exactly 1 argument");
+    }
+    obj = (xpaconn_t*)yget_obj(0, &xpaconn_type);
+    close_xpaconn(obj);
+}
+
 /*---------------------------------------------------------------------------*/
 /* XPA DATA OBJECT */
 
-/* A number of static arrays is used to collect received messages and data. */
-#define NMAX 100
-static size_t lens[NMAX];
-static char*  bufs[NMAX];
-static char*  srvs[NMAX];
-static char*  msgs[NMAX];
-static int replies = 0; /* number of replies stored in static arrays */
+/* Received messages and data are collected in dynamically sized arrays
+   which grow as needed and are reused between calls. */
+typedef struct replies {
+    size_t* lens;
+    char**  bufs;
+    char**  srvs;
+    char**  msgs;
+    int     count; /* number of stored replies */
+    int     size;  /* number of allocated slots */
+} replies_t;
+
+static replies_t shared_replies = {NULL, NULL, NULL, NULL, 0, 0};
 
 typedef struct xpadata {
     size_t* lens;
@@ -217,6 +595,24 @@ print_xpadata(void* addr)
     y_print(buffer, 1);
 }
 
+/* Yields the (0-based) index of the reply specified by argument `iarg`
+   following Yorick indexing rules. */
+static long get_reply_index(xpadata_t* obj, int iarg)
+{
+    long i;
+    if (! IS_INTEGER(yarg_typeid(iarg)) || yarg_rank(iarg) != 0) {
+        y_error("expecting an index");
+    }
+    i = ygets_l(iarg);
+    if (i <= 0) {
+        i += obj->replies;
+    }
+    if (i < 1 || i > obj->replies) {
+        y_error("out of range index");
+    }
+    return i - 1; /* C indices start at 0 */
+}
+
 static void
 eval_xpadata(void* addr, int argc)
 {
@@ -237,17 +633,7 @@ eval_xpadata(void* addr, int argc)
         ypush_long(obj->replies);
         return;
     }
-    if (! IS_INTEGER(typeid) || yarg_rank(iarg) != 0) {
-        y_error("expecting an index");
-    }
-    i = ygets_l(iarg);
-    if (i <= 0) {
-        i += obj->replies;
-    }
-    if (i < 1 || i > obj->replies) {
-        y_error("out of range index");
-    }
-    --i; /* C indices start at 0 */
+    i = get_reply_index(obj, iarg);
     if (argc == 1) {
         push_string(obj->msgs[i], -1);
         return;
@@ -290,7 +676,7 @@ eval_xpadata(void* addr, int argc)
             /* Push data as an array of bytes. */
             size_t len = obj->lens[i];
             char* buf = obj->bufs[i];
-            if (len > 0) {
+            if (buf != NULL && len > 0) {
                 dims[0] = 1;
                 dims[1] = len;
                 memcpy(ypush_c(dims), buf, len);
@@ -303,7 +689,7 @@ eval_xpadata(void* addr, int argc)
             /* Push data as a string. */
             size_t len = obj->lens[i];
             char* buf = obj->bufs[i];
-            if (len > 0) {
+            if (buf != NULL && len > 0) {
                 push_string(buf, len);
             } else {
                 push_string(NULL, 0);
@@ -316,16 +702,9 @@ eval_xpadata(void* addr, int argc)
         char* buf = obj->bufs[i];
         long ntot;
         void* arr = ygeta_any(iarg, &ntot, NULL, &typeid);
-        size_t size;
-        switch (typeid) {
-        case Y_CHAR: size = ntot*sizeof(char); break;
-        case Y_SHORT: size = ntot*sizeof(short); break;
-        case Y_INT: size = ntot*sizeof(int); break;
-        case Y_LONG: size = ntot*sizeof(long); break;
-        case Y_FLOAT: size = ntot*sizeof(float); break;
-        case Y_DOUBLE: size = ntot*sizeof(double); break;
-        case Y_COMPLEX: size = 2*ntot*sizeof(double); break;
-        default: size = 0; y_error("invalid array type");
+        size_t size = ntot*elem_size(typeid);
+        if (buf == NULL && len > 0) {
+            y_error("data have not been stored in memory");
         }
         if (size != len) {
             y_error("invalid array size");
@@ -364,226 +743,5837 @@ static y_userobj_t xpadata_type = {
     NULL
 };
 
-static void clear_static_arrays()
+/*---------------------------------------------------------------------------*/
+/* DECODING OF FITS DATA */
+
+#define FITS_BLOCK 2880 /* size of a FITS block */
+#define FITS_CARD    80 /* size of a FITS header card */
+
+#if defined(__GNUC__) && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 8))
+#  define BSWAP16(x) __builtin_bswap16(x)
+#  define BSWAP32(x) __builtin_bswap32(x)
+#  define BSWAP64(x) __builtin_bswap64(x)
+#else
+#  define BSWAP16(x) ((uint16_t)(((x) >> 8) | ((x) << 8)))
+#  define BSWAP32(x) ((((x) >> 24) & 0x000000FFU) | \
+                      (((x) >>  8) & 0x0000FF00U) | \
+                      (((x) <<  8) & 0x00FF0000U) | \
+                      (((x) << 24) & 0xFF000000U))
+#  define BSWAP64(x) (((uint64_t)BSWAP32((uint32_t)(x)) << 32) | \
+                      (uint64_t)BSWAP32((uint32_t)((x) >> 32)))
+#endif
+
+/* Copies `n` big endian values of `size` bytes from `src` to `dst` in
+   native byte order.  The loops are simple enough to be vectorized by the
+   compiler. */
+static void decode_big_endian(void* dst, const void* src, size_t n,
+                              size_t size)
 {
-    if (p_signalling) {
-        p_abort();
-    }
-    while (replies > 0) {
-        int i = replies - 1;
-        char* ptr;
-        if ((ptr = bufs[i]) != NULL) {
-            bufs[i] = NULL;
-            free(ptr);
+    size_t i;
+    if (size == 1 || ! little_endian()) {
+        memcpy(dst, src, n*size);
+    } else if (size == 2) {
+        const uint16_t* s = (const uint16_t*)src;
+        uint16_t* d = (uint16_t*)dst;
+        for (i = 0; i < n; ++i) {
+            d[i] = BSWAP16(s[i]);
         }
-        if ((ptr = srvs[i]) != NULL) {
-            bufs[i] = NULL;
-            free(ptr);
+    } else if (size == 4) {
+        const uint32_t* s = (const uint32_t*)src;
+        uint32_t* d = (uint32_t*)dst;
+        for (i = 0; i < n; ++i) {
+            d[i] = BSWAP32(s[i]);
         }
-        if ((ptr = msgs[i]) != NULL) {
-            bufs[i] = NULL;
-            free(ptr);
+    } else {
+        const uint64_t* s = (const uint64_t*)src;
+        uint64_t* d = (uint64_t*)dst;
+        for (i = 0; i < n; ++i) {
+            d[i] = BSWAP64(s[i]);
         }
-        replies = i;
-    }
-    if (replies < 0) {
-        replies = 0;
     }
 }
 
-static void push_xpadata()
+/* Yields the value of a FITS card as a double (returns 0 if the card has no
+   numerical value). */
+static int fits_value(const char* card, double* val)
 {
-    xpadata_t* obj;
-    size_t size, offset, stride;
+    char buf[FITS_CARD + 1];
+    char* end;
     int i;
-
-    /* Reduce the risk of being interrupted. */
-    if (p_signalling) {
-        p_abort();
+    if (card[8] != '=' || card[9] != ' ') {
+        return 0;
     }
-
-    /* Compute object size. */
-    if (replies < 0) {
-        replies = 0;
+    for (i = 10; i < FITS_CARD && card[i] != '/'; ++i) {
+        buf[i - 10] = (card[i] == 'D' ? 'E' : card[i]);
     }
-    offset = ROUND_UP(sizeof(xpadata_t), sizeof(void*));
-    stride = replies*sizeof(void*);
-    size = offset + 4*stride;
-
-    /* Push a new object and instanciate it.  Note that memory returned by
-       ypush_obj has been zero-filled. */
-    obj = (xpadata_t*)ypush_obj(&xpadata_type, size);
-    obj->replies = 0;
-    obj->buffers = -1;
-    obj->messages = -1;
-    obj->errors = -1;
-    obj->lens = (size_t*)((char*)obj + offset);
-    obj->bufs = (char**)((char*)obj + offset + stride);
-    obj->srvs = (char**)((char*)obj + offset + 2*stride);
-    obj->msgs = (char**)((char*)obj + offset + 3*stride);
-    for (i = 0; i < replies; ++i) {
-        /* Copy contents, taking care of interrupts.  Note that buffer lengths
-           only have a valid value for non-NULL buffers. */
-        obj->lens[i] = (bufs[i] == NULL ? 0 : lens[i]);
-        obj->bufs[i] = bufs[i];
-        obj->srvs[i] = srvs[i];
-        obj->msgs[i] = msgs[i];
-        bufs[i] = NULL;
-        msgs[i] = NULL;
-        srvs[i] = NULL;
-        ++obj->replies;
+    buf[i - 10] = '\0';
+    *val = strtod(buf, &end);
+    if (end == buf) {
+        return 0;
     }
-    replies = 0;
+    while (*end == ' ') {
+        ++end;
+    }
+    return (*end == '\0');
 }
 
-void Y_xpa_get(int argc)
+/* Yields whether a FITS card has a given keyword. */
+static int fits_match(const char* card, const char* key)
 {
-    char* apt = NULL;
-    char* cmd = NULL;
-    int typeid, iarg, nmax = 1, npos = 0;
-
-    /* Parse arguments. */
-    for (iarg = argc - 1; iarg >= 0; --iarg) {
-        long index = yarg_key(iarg);
-        if (index == -1) {
-            /* Positional argument. */
-            ++npos;
-            if (npos == 1) {
-                /* Get access point. */
-                if (! IS_SCALAR_STRING(iarg)) {
-                    y_error("access point must be a string");
-                }
-                apt = ygets_q(iarg);
-            } else if (npos == 2) {
-                /* Get command. */
-                typeid = yarg_typeid(iarg);
-                if (IS_STRING(typeid) && yarg_rank(iarg) == 0) {
-                    cmd = ygets_q(iarg);
-                } else if (! IS_VOID(typeid)) {
-                    y_error("command must be empty or a string");
-                }
-            } else {
-                goto args;
-            }
-        } else {
-            /* Keyword argument. */
-            --iarg;
-            if (index_of_nmax < 0) {
-                initialize_indices();
-            }
-            if (index == index_of_nmax) {
-                typeid = yarg_typeid(iarg);
-                if (IS_INTEGER(typeid) && yarg_rank(iarg) == 0) {
-                    nmax = ygets_l(iarg);
-                    if (nmax == -1) {
-                        nmax = NMAX;
-                    }
-                    if (nmax < 0 || nmax > NMAX) {
-                        y_error("out of range value for keyword `nmax`");
-                    }
-                } else if (! IS_VOID(typeid)) {
-                    y_error("keyword `nmax` takes an integer value");
-                }
-            } else {
-                y_error("unknown keyword");
-            }
+    int i;
+    for (i = 0; i < 8 && key[i] != '\0'; ++i) {
+        if (card[i] != key[i]) {
+            return 0;
         }
     }
-    if (npos < 1) {
-    args:
-        y_error("expecting 1 or 2 arguments");
-    }
-
-    /* Evaluate the XPA get command. */
-    if (client == NULL) {
-        connect();
+    for (; i < 8; ++i) {
+        if (card[i] != ' ') {
+            return 0;
+        }
     }
-    clear_static_arrays();
-    replies = XPAGet(client, apt, cmd, NULL, bufs, lens, srvs, msgs, nmax);
-    push_xpadata();
+    return 1;
 }
 
-void Y_xpa_set(int argc)
+/* Converts `n` raw FITS values (of type `SRC` and size `SIZE`, big endian)
+   into values of type `DST` applying `bzero` and `bscale`, by chunks. */
+#define DECODE_SCALED(DST, SRC, SIZE, EXPR)                             \
+    do {                                                                \
+        DST* out = (DST*)arr;                                           \
+        SRC tmp[1024];                                                  \
+        size_t j, m;                                                    \
+        for (i = 0; i < number; i += m) {                               \
+            m = (number - i < 1024 ? number - i : 1024);                \
+            decode_big_endian(tmp, data + i*(SIZE), m, (SIZE));         \
+            for (j = 0; j < m; ++j) {                                   \
+                out[i + j] = EXPR;                                      \
+            }                                                           \
+        }                                                               \
+    } while (0)
+
+void Y_xpa_fits(int argc)
 {
-    char* apt = NULL;
-    char* cmd = NULL;
-    char* buf = NULL;
-    size_t len = 0;
-    long ntot;
-    int typeid, iarg, nmax = 1, npos = 0;
+    long dims[Y_DIMSIZE];
+    xpadata_t* obj = NULL;
+    const char* buf;
+    const char* data;
+    const char* card;
+    char** cards;
+    double bscale = 1.0, bzero = 0.0, val;
+    size_t len, hdrlen, number, i;
+    long ref = -1, index, ncards, k;
+    int iarg, npos = 0, take = 0, idx = 0, naxis = -1;
+    char seen[Y_DIMSIZE]; /* NAXISn cards which have been seen */
+    int bitpix = 0, elsize, typeid, scaled, offset, end = 0;
+    void* arr;
 
     /* Parse arguments. */
     for (iarg = argc - 1; iarg >= 0; --iarg) {
-        long index = yarg_key(iarg);
+        index = yarg_key(iarg);
         if (index == -1) {
-            /* Positional argument. */
             ++npos;
             if (npos == 1) {
-                /* Get access point. */
-                if (! IS_SCALAR_STRING(iarg)) {
-                    y_error("access point must be a string");
-                }
-                apt = ygets_q(iarg);
+                obj = (xpadata_t*)yget_obj(iarg, &xpadata_type);
             } else if (npos == 2) {
-                /* Get command. */
-                typeid = yarg_typeid(iarg);
-                if (IS_STRING(typeid) && yarg_rank(iarg) == 0) {
-                    cmd = ygets_q(iarg);
-                } else if (! IS_VOID(typeid)) {
-                    y_error("command must be empty or a string");
+                if (! yarg_nil(iarg)) {
+                    idx = get_reply_index(obj, iarg);
                 }
             } else if (npos == 3) {
-                /* Get data. */
-                buf = ygeta_any(iarg, &ntot, NULL, &typeid);
-                switch (typeid) {
-                case Y_CHAR: len = ntot*sizeof(char); break;
-                case Y_SHORT: len = ntot*sizeof(short); break;
-                case Y_INT: len = ntot*sizeof(int); break;
-                case Y_LONG: len = ntot*sizeof(long); break;
-                case Y_FLOAT: len = ntot*sizeof(float); break;
-                case Y_DOUBLE: len = ntot*sizeof(double); break;
-                case Y_COMPLEX: len = 2*ntot*sizeof(double); break;
-                default: y_error("invalid array type");
+                ref = yget_ref(iarg);
+                if (ref < 0 && ! yarg_nil(iarg)) {
+                    y_error("header must be returned in a simple variable");
                 }
             } else {
-                goto args;
+                y_error("too many arguments");
             }
         } else {
-            /* Keyword argument. */
             --iarg;
-            if (index_of_nmax < 0) {
+            if (index_of_take < 0) {
                 initialize_indices();
             }
-            if (index == index_of_nmax) {
-                typeid = yarg_typeid(iarg);
-                if (IS_INTEGER(typeid) && yarg_rank(iarg) == 0) {
-                    nmax = ygets_l(iarg);
-                    if (nmax == -1) {
-                        nmax = NMAX;
-                    }
-                    if (nmax < 0 || nmax > NMAX) {
-                        y_error("out of range value for keyword `nmax`");
-                    }
-                } else if (! IS_VOID(typeid)) {
-                    y_error("keyword `nmax` takes an integer value");
-                }
+            if (index == index_of_take) {
+                take = yarg_true(iarg);
             } else {
                 y_error("unknown keyword");
             }
         }
     }
-    if (npos < 1) {
-    args:
-        y_error("expecting 1, 2 or 3 arguments");
+    if (obj == NULL) {
+        y_error("expecting an XPA answer");
+    }
+    if (obj->replies < 1) {
+        y_error("no replies");
     }
 
-    /* Evaluate the XPA set command. */
-    if (client == NULL) {
-        connect();
+    /* Parse the primary header. */
+    buf = obj->bufs[idx];
+    len = obj->lens[idx];
+    if (buf == NULL || len < FITS_BLOCK ||
+        ! fits_match(buf, "SIMPLE") || buf[29] != 'T') {
+        y_error("reply data is not a FITS file");
+    }
+    ncards = 0;
+    memset(seen, 0, sizeof(seen));
+    for (hdrlen = 0; ! end; hdrlen += FITS_BLOCK) {
+        if (hdrlen + FITS_BLOCK > len) {
+            y_error("truncated FITS header");
+        }
+        for (k = 0; k < FITS_BLOCK/FITS_CARD; ++k) {
+            card = buf + hdrlen + k*FITS_CARD;
+            if (fits_match(card, "END")) {
+                end = 1;
+                break;
+            }
+            ++ncards;
+            if (fits_match(card, "BITPIX")) {
+                if (! fits_value(card, &val)) goto bad_card;
+                bitpix = (int)val;
+            } else if (fits_match(card, "NAXIS")) {
+                if (! fits_value(card, &val)) goto bad_card;
+                naxis = (int)val;
+                if (naxis < 0 || naxis > Y_DIMSIZE - 1) {
+                    y_error("unsupported number of dimensions");
+                }
+                dims[0] = naxis;
+            } else if (strncmp(card, "NAXIS", 5) == 0 &&
+                       '1' <= card[5] && card[5] <= '9') {
+                int n = atoi(card + 5);
+                if (! fits_value(card, &val)) goto bad_card;
+                if (n < 1 || n > naxis || val < 1) {
+                    y_error("invalid NAXISn card");
+                }
+                dims[n] = (long)val;
+                seen[n] = 1;
+            } else if (fits_match(card, "BSCALE")) {
+                if (! fits_value(card, &bscale)) goto bad_card;
+            } else if (fits_match(card, "BZERO")) {
+                if (! fits_value(card, &bzero)) goto bad_card;
+            }
+        }
+    }
+    if (naxis < 0) {
+        y_error("missing NAXIS card");
+    }
+    for (k = 1; k <= naxis; ++k) {
+        if (! seen[k]) {
+            char msg[40];
+            sprintf(msg, "missing NAXIS%ld card", k);
+            y_error(msg);
+        }
+    }
+
+    /* Determine the type of the result.  The number of elements is checked
+       against the size of the reply by divisions to avoid overflows. */
+    number = (naxis > 0 ? 1 : 0);
+    for (k = 1; k <= naxis; ++k) {
+        if ((size_t)dims[k] > len/number) {
+            y_error("truncated FITS data");
+        }
+        number *= dims[k];
+    }
+    switch (bitpix) {
+    case   8: elsize = 1; typeid = Y_CHAR;   break;
+    case  16: elsize = 2; typeid = Y_SHORT;  break;
+    case  32: elsize = 4; typeid = Y_INT;    break;
+    case  64: elsize = 8; typeid = Y_LONG;   break;
+    case -32: elsize = 4; typeid = Y_FLOAT;  break;
+    case -64: elsize = 8; typeid = Y_DOUBLE; break;
+    default: y_error("invalid BITPIX value"); return;
+    }
+    if ((bitpix == 32 && sizeof(int) != 4) ||
+        (bitpix == 16 && sizeof(short) != 2) ||
+        (bitpix == 64 && sizeof(long) != 8)) {
+        y_error("unsupported BITPIX on this machine");
+    }
+    if (number > (len - hdrlen)/elsize) {
+        y_error("truncated FITS data");
+    }
+    data = buf + hdrlen;
+    scaled = (bscale != 1.0 || bzero != 0.0);
+    offset = 0;
+    if (scaled) {
+        if (bitpix > 0 && bscale == 1.0 && bzero == (double)(long)bzero &&
+            bitpix < 64) {
+            /* Integer offset (e.g. unsigned integers): use the next larger
+               integer type. */
+            offset = 1;
+            typeid = (bitpix == 8 ? Y_SHORT : bitpix == 16 ? Y_INT : Y_LONG);
+        } else if (bitpix != -32) {
+            typeid = Y_DOUBLE;
+        }
+    }
+
+    /* Push the header cards (in the output variable) and the image. */
+    if (ref >= 0) {
+        long cdims[2];
+        cdims[0] = 1;
+        cdims[1] = ncards;
+        if (ncards > 0) {
+            cards = ypush_q(cdims);
+            for (k = 0; k < ncards; ++k) {
+                int n = FITS_CARD;
+                card = buf + k*FITS_CARD;
+                while (n > 0 && card[n - 1] == ' ') {
+                    --n;
+                }
+                cards[k] = p_malloc(n + 1);
+                memcpy(cards[k], card, n);
+                cards[k][n] = '\0';
+            }
+        } else {
+            ypush_nil();
+        }
+        yput_global(ref, 0);
+        yarg_drop(1);
+    }
+    if (naxis == 0) {
+        /* No data. */
+        ypush_nil();
+        goto release;
+    }
+    arr = push_array(typeid, dims);
+    if (! scaled) {
+        decode_big_endian(arr, data, number, elsize);
+    } else if (offset) {
+        long z = (long)bzero;
+        if (bitpix == 8) {
+            DECODE_SCALED(short, uint8_t, 1, (short)(tmp[j] + z));
+        } else if (bitpix == 16) {
+            DECODE_SCALED(int, int16_t, 2, (int)(tmp[j] + z));
+        } else {
+            DECODE_SCALED(long, int32_t, 4, (long)tmp[j] + z);
+        }
+    } else if (bitpix == -32) {
+        float a = (float)bscale, b = (float)bzero;
+        DECODE_SCALED(float, float, 4, a*tmp[j] + b);
+    } else {
+        switch (bitpix) {
+        case 8:
+            DECODE_SCALED(double, uint8_t, 1, bscale*tmp[j] + bzero);
+            break;
+        case 16:
+            DECODE_SCALED(double, int16_t, 2, bscale*tmp[j] + bzero);
+            break;
+        case 32:
+            DECODE_SCALED(double, int32_t, 4, bscale*tmp[j] + bzero);
+            break;
+        case 64:
+            DECODE_SCALED(double, int64_t, 8, bscale*tmp[j] + bzero);
+            break;
+        default:
+            DECODE_SCALED(double, double, 8, bscale*tmp[j] + bzero);
+        }
+    }
+
+    /* Release the buffer if requested. */
+ release:
+    if (take) {
+        char* ptr = obj->bufs[idx];
+        obj->bufs[idx] = NULL;
+        obj->lens[idx] = 0;
+        obj->buffers = -1;
+        free(ptr);
+    }
+    return;
+
+ bad_card:
+    y_error("invalid FITS card value");
+}
+
+#undef DECODE_SCALED
+
+/* Frees the contents of the replies stored in `r`. */
+static void clear_replies(replies_t* r)
+{
+    while (r->count > 0) {
+        int i = r->count - 1;
+        char* ptr;
+        r->lens[i] = 0;
+        if ((ptr = r->bufs[i]) != NULL) {
+            r->bufs[i] = NULL;
+            free(ptr);
+        }
+        if ((ptr = r->srvs[i]) != NULL) {
+            r->srvs[i] = NULL;
+            free(ptr);
+        }
+        if ((ptr = r->msgs[i]) != NULL) {
+            r->msgs[i] = NULL;
+            free(ptr);
+        }
+        r->count = i;
+    }
+    if (r->count < 0) {
+        r->count = 0;
+    }
+}
+
+/* Makes sure that `r` has at least `n` slots for storing replies.  The
+   arrays are grown geometrically and new slots are zero-filled.  Returns 0
+   on success, -1 on failure (insufficient memory). */
+static int reserve_replies(replies_t* r, int n)
+{
+    if (n > r->size) {
+        size_t* lens;
+        char** ptrs;
+        size_t size = (r->size < 16 ? 16 : r->size);
+        while (size < (size_t)n) {
+            /* Double the size but never beyond `n` when this would overflow
+               the number of slots (an `int`). */
+            size = (size > (size_t)(INT_MAX/2) ? (size_t)n : 2*size);
+        }
+        if (size > SIZE_MAX/(3*sizeof(char*))) {
+            return -1;
+        }
+        lens = (size_t*)malloc(size*sizeof(size_t));
+        ptrs = (char**)malloc(3*size*sizeof(char*));
+        if (lens == NULL || ptrs == NULL) {
+            free(lens);
+            free(ptrs);
+            return -1;
+        }
+        memset(lens, 0, size*sizeof(size_t));
+        memset(ptrs, 0, 3*size*sizeof(char*));
+        if (r->count > 0) {
+            memcpy(lens, r->lens, r->count*sizeof(size_t));
+            memcpy(ptrs, r->bufs, r->count*sizeof(char*));
+            memcpy(ptrs + size, r->srvs, r->count*sizeof(char*));
+            memcpy(ptrs + 2*size, r->msgs, r->count*sizeof(char*));
+        }
+        free(r->lens);
+        free(r->bufs); /* `bufs`, `srvs` and `msgs` share the same block */
+        r->lens = lens;
+        r->bufs = ptrs;
+        r->srvs = ptrs + size;
+        r->msgs = ptrs + 2*size;
+        r->size = size;
+    }
+    return 0;
+}
+
+/* Releases all resources associated with `r`. */
+static void free_replies(replies_t* r)
+{
+    clear_replies(r);
+    free(r->lens);
+    free(r->bufs);
+    r->lens = NULL;
+    r->bufs = NULL;
+    r->srvs = NULL;
+    r->msgs = NULL;
+    r->size = 0;
+}
+
+/* Prepares the shared storage for receiving up to `n` replies. */
+static replies_t* get_shared_replies(int n)
+{
+    if (p_signalling) {
+        p_abort();
+    }
+    clear_replies(&shared_replies);
+    if (reserve_replies(&shared_replies, n) != 0) {
+        y_error("insufficient memory for storing XPA replies");
+    }
+    return &shared_replies;
+}
+
+/* Pushes a new XPAData object on top of the stack and moves the replies
+   stored in `r` into it.  Moved pointers are set to NULL in `r` which is left
+   empty. */
+static void push_xpadata(replies_t* r)
+{
+    xpadata_t* obj;
+    size_t size, offset, stride;
+    int i, n;
+
+    /* Reduce the risk of being interrupted. */
+    if (p_signalling) {
+        p_abort();
+    }
+
+    /* Compute object size. */
+    n = (r->count > 0 ? r->count : 0);
+    offset = ROUND_UP(sizeof(xpadata_t), sizeof(void*));
+    stride = n*sizeof(void*);
+    size = offset + 4*stride;
+
+    /* Push a new object and instanciate it.  Note that memory returned by
+       ypush_obj has been zero-filled. */
+    obj = (xpadata_t*)ypush_obj(&xpadata_type, size);
+    obj->replies = 0;
+    obj->buffers = -1;
+    obj->messages = -1;
+    obj->errors = -1;
+    obj->lens = (size_t*)((char*)obj + offset);
+    obj->bufs = (char**)((char*)obj + offset + stride);
+    obj->srvs = (char**)((char*)obj + offset + 2*stride);
+    obj->msgs = (char**)((char*)obj + offset + 3*stride);
+    for (i = 0; i < n; ++i) {
+        /* Copy contents, taking care of interrupts.  Note that the length of
+           a NULL buffer is the number of bytes written to a file descriptor
+           (see `xpa_get_into`). */
+        obj->lens[i] = r->lens[i];
+        obj->bufs[i] = r->bufs[i];
+        obj->srvs[i] = r->srvs[i];
+        obj->msgs[i] = r->msgs[i];
+        r->bufs[i] = NULL;
+        r->msgs[i] = NULL;
+        r->srvs[i] = NULL;
+        ++obj->replies;
+    }
+    r->count = 0;
+}
+
+/*---------------------------------------------------------------------------*/
+/* ARGUMENTS OF XPA GET/SET COMMANDS */
+
+#define MODE_SIZE 48 /* size of XPA mode strings, enough for
+                        "ack=false,doxpa=false,verify=false" */
+
+typedef struct params {
+    char*  apt;   /* access point */
+    char** apts;  /* access points for a fan-out */
+    long   napts; /* number of access points */
+    char*  cmd;   /* command (parameter list) */
+    char*  buf;   /* data to send */
+    size_t len;   /* number of bytes to send */
+    int    data;  /* stack index of data argument (-1 if none) */
+    int    nmax;  /* maximum number of recipients (-1 for all) */
+    long   offset; /* offset in file (PARSE_FILE mode) */
+    long   length; /* number of bytes to send (PARSE_FILE mode, -1 for
+                      all) */
+    int    fits;  /* send a FITS file? (PARSE_IMAGE mode) */
+    xpaconn_t* conn; /* connection to use (NULL for the shared one) */
+    int    lane;  /* lane of transfer processes (LANE_CONTROL, LANE_BULK or
+                     LANE_CONN) */
+    double timeout; /* maximum time to wait for the replies (0 for none) */
+    char   mode[MODE_SIZE]; /* XPA mode string (empty for default) */
+} params_t;
+
+/* Yields the XPA mode string of a command (NULL for the default mode). */
+#define MODE(p) ((p)->mode[0] != '\0' ? (p)->mode : NULL)
+
+static int have_servers();
+static void end_timeout();
+
+/* Builds in `dst` the mode string `src` with `doxpa=false` so that the
+   access points of Yorick are not served during the command (the Yorick
+   handlers would run in the middle of it and a handler issuing XPA
+   commands would clobber its replies, a transfer process must never serve
+   them at all).  `dst` must have at least MODE_SIZE + 12 bytes. */
+static void noxpa_mode(char* dst, const char* src)
+{
+    const char* end;
+    size_t n, len = 0;
+    for (; *src != '\0'; src = (*end == ',' ? end + 1 : end)) {
+        end = strchr(src, ',');
+        if (end == NULL) {
+            end = src + strlen(src);
+        }
+        n = end - src;
+        if (n > 0 && strncmp(src, "doxpa=", 6) != 0) {
+            memcpy(dst + len, src, n);
+            len += n;
+            dst[len++] = ',';
+        }
+    }
+    strcpy(dst + len, "doxpa=false");
+}
+
+/* Yields the mode string of XPA client commands without mode keywords. */
+static char* default_mode()
+{
+    return (have_servers() ? "doxpa=false" : NULL);
+}
+
+/* Lanes of transfer processes.  Control commands are run by the shared
+   connection or by the default pool of transfer processes while bulk
+   transfers are run by a separate pool so that they never delay control
+   commands. */
+#define LANE_CONTROL 0
+#define LANE_BULK    1
+#define LANE_CONN    2 /* transfer process of a connection with a method */
+
+/* Kinds of argument lists parsed by `parse_params`. */
+#define PARSE_GET  0 /* apt [, cmd] */
+#define PARSE_SET  1 /* apt [, cmd [, data]] */
+#define PARSE_DEST 2 /* apt, cmd, dest (only the position of dest is
+                        stored in `data`) */
+#define PARSE_FILE 3 /* as PARSE_DEST plus `offset` and `length`
+                        keywords */
+#define PARSE_IMAGE 4 /* as PARSE_SET plus `fits` keyword */
+
+/* Parses the arguments of an XPA get or set command according to `mode`
+   (one of `PARSE_GET`, `PARSE_SET` or `PARSE_DEST`). */
+static void parse_params(int argc, int mode, params_t* p)
+{
+    long ntot;
+    int typeid, iarg, npos = 0;
+
+    end_timeout(); /* in case an error occurred during the last command */
+    p->apt = NULL;
+    p->apts = NULL;
+    p->napts = 0;
+    p->cmd = NULL;
+    p->buf = NULL;
+    p->len = 0;
+    p->data = -1;
+    p->nmax = 1;
+    p->offset = 0;
+    p->length = -1;
+    p->fits = 0;
+    p->conn = NULL;
+    p->lane = LANE_CONTROL;
+    p->timeout = 0.0;
+    p->mode[0] = '\0';
+    for (iarg = argc - 1; iarg >= 0; --iarg) {
+        long index = yarg_key(iarg);
+        if (index == -1) {
+            /* Positional argument. */
+            ++npos;
+            if (npos == 1) {
+                /* Get access point(s). */
+                long k;
+                if (yarg_string(iarg) == 0) {
+                    y_error("access point must be a string");
+                }
+                p->apts = ygeta_q(iarg, &p->napts, NULL);
+                for (k = 0; k < p->napts; ++k) {
+                    if (p->apts[k] == NULL) {
+                        y_error("access point must not be a null string");
+                    }
+                }
+                p->apt = p->apts[0];
+            } else if (npos == 2) {
+                /* Get command. */
+                typeid = yarg_typeid(iarg);
+                if (IS_STRING(typeid) && yarg_rank(iarg) == 0) {
+                    p->cmd = ygets_q(iarg);
+                } else if (! IS_VOID(typeid)) {
+                    y_error("command must be empty or a string");
+                }
+            } else if (npos == 3 && (mode == PARSE_DEST ||
+                                     mode == PARSE_FILE)) {
+                /* Destination will be parsed by the caller. */
+                p->data = iarg;
+            } else if (npos == 3 && (mode == PARSE_SET ||
+                                     mode == PARSE_IMAGE)) {
+                /* Get data. */
+                if (! IS_VOID(yarg_typeid(iarg))) {
+                    p->buf = ygeta_any(iarg, &ntot, NULL, &typeid);
+                    p->len = ntot*elem_size(typeid);
+                    if (p->len == 0 && ntot > 0) {
+                        y_error("invalid array type");
+                    }
+                    p->data = iarg;
+                }
+            } else {
+                goto args;
+            }
+        } else {
+            /* Keyword argument. */
+            --iarg;
+            if (index_of_nmax < 0) {
+                initialize_indices();
+            }
+            if (index == index_of_nmax) {
+                p->nmax = get_nmax(iarg);
+            } else if (mode == PARSE_FILE && index == index_of_offset) {
+                typeid = yarg_typeid(iarg);
+                if (IS_INTEGER(typeid) && yarg_rank(iarg) == 0) {
+                    p->offset = ygets_l(iarg);
+                    if (p->offset < 0) {
+                        y_error("invalid value for keyword `offset`");
+                    }
+                } else if (! IS_VOID(typeid)) {
+                    y_error("keyword `offset` takes an integer value");
+                }
+            } else if (mode == PARSE_FILE && index == index_of_length) {
+                typeid = yarg_typeid(iarg);
+                if (IS_INTEGER(typeid) && yarg_rank(iarg) == 0) {
+                    p->length = ygets_l(iarg);
+                    if (p->length < -1) {
+                        y_error("invalid value for keyword `length`");
+                    }
+                } else if (! IS_VOID(typeid)) {
+                    y_error("keyword `length` takes an integer value");
+                }
+            } else if (mode == PARSE_IMAGE && index == index_of_fits) {
+                p->fits = yarg_true(iarg);
+            } else if (index == index_of_ack || index == index_of_doxpa ||
+                       index == index_of_verify) {
+                if (! yarg_nil(iarg)) {
+                    const char* key = (index == index_of_ack ? "ack" :
+                                       index == index_of_doxpa ? "doxpa" :
+                                       "verify");
+                    size_t len = strlen(p->mode);
+                    snprintf(p->mode + len, MODE_SIZE - len, "%s%s=%s",
+                             (len > 0 ? "," : ""), key,
+                             (yarg_true(iarg) ? "true" : "false"));
+                }
+            } else if ((mode == PARSE_GET || mode == PARSE_SET) &&
+                       index == index_of_timeout) {
+                if (! yarg_nil(iarg)) {
+                    p->timeout = ygets_d(iarg);
+                    if (p->timeout < 0.0) {
+                        y_error("invalid value for keyword `timeout`");
+                    }
+                }
+            } else if (index == index_of_lane) {
+                if (! yarg_nil(iarg)) {
+                    const char* str;
+                    if (! IS_SCALAR_STRING(iarg)) {
+                        y_error("keyword `lane` takes a string value");
+                    }
+                    str = ygets_q(iarg);
+                    if (str != NULL && strcmp(str, "control") == 0) {
+                        p->lane = LANE_CONTROL;
+                    } else if (str != NULL && strcmp(str, "bulk") == 0) {
+                        p->lane = LANE_BULK;
+                    } else {
+                        y_error("keyword `lane` must be \"control\" or "
+                                "\"bulk\"");
+                    }
+                }
+            } else if (mode != PARSE_DEST && index == index_of_conn) {
+                if (! yarg_nil(iarg)) {
+                    p->conn = (xpaconn_t*)yget_obj(iarg, &xpaconn_type);
+                    if (! CONN_OPEN(p->conn)) {
+                        y_error("XPA connection has been closed");
+                    }
+                }
+            } else {
+                y_error("unknown keyword");
+            }
+        }
+    }
+    if (npos < (mode == PARSE_DEST || mode == PARSE_FILE ? 3 : 1)) {
+    args:
+        y_error(mode == PARSE_GET ? "expecting 1 or 2 arguments" :
+                mode == PARSE_SET || mode == PARSE_IMAGE ?
+                "expecting 1, 2 or 3 arguments" : "expecting 3 arguments");
+    }
+    if (p->conn != NULL && p->napts > 1) {
+        y_error("keyword `conn` cannot be used with several access points");
+    }
+    if (p->conn != NULL && p->conn->pool != NULL) {
+        p->lane = LANE_CONN;
+    }
+    if (have_servers()) {
+        char tmp[MODE_SIZE + 12];
+        noxpa_mode(tmp, p->mode);
+        strcpy(p->mode, tmp);
+    }
+}
+
+/* Yields the XPA handle to use for a command. */
+static XPA get_handle(const params_t* p)
+{
+    if (p->conn != NULL) {
+        return p->conn->xpa;
+    }
+    if (client == NULL) {
+        connect_client();
+    }
+    return client;
+}
+
+/* A command with keyword `timeout` and a single access point is run by its
+   handle (the connections to the servers are kept) with the short and long
+   timeouts of XPA (XPA_SHORT_TIMEOUT and XPA_LONG_TIMEOUT) temporarily set
+   to the timeout rounded up to whole seconds.  These timeouts are process
+   wide settings which XPA only reads from the environment once, they are
+   changed by the handlers of the reserved commands "-stimeout" and
+   "-ltimeout" (as `xpaset -p apt -ltimeout secs` does for a server).  Only
+   the main thread calls XPA, so no other command can see them. */
+static int saved_stimeout = -1; /* short timeout to restore (-1 if none) */
+static int saved_ltimeout = -1; /* long timeout to restore */
+
+static void set_timeouts(int stimeout, int ltimeout)
+{
+    char val[32];
+    sprintf(val, "%d", stimeout);
+    XPAReceiveSTimeout(NULL, NULL, val, NULL, 0);
+    sprintf(val, "%d", ltimeout);
+    XPAReceiveLTimeout(NULL, NULL, val, NULL, 0);
+}
+
+/* Applies the timeout of a command (if any) to XPA. */
+static void begin_timeout(const params_t* p)
+{
+    if (p->timeout > 0.0 && saved_stimeout < 0) {
+        int secs = (p->timeout < INT_MAX ? (int)ceil(p->timeout) : INT_MAX);
+        saved_stimeout = XPAShortTimeout();
+        saved_ltimeout = XPALongTimeout();
+        set_timeouts(secs, secs);
+    }
+}
+
+/* Restores the timeouts of XPA after `begin_timeout`. */
+static void end_timeout()
+{
+    if (saved_stimeout >= 0) {
+        set_timeouts(saved_stimeout, saved_ltimeout);
+        saved_stimeout = -1;
+    }
+}
+
+/* Yields the number of access points matching `apt` for access `type`
+   ("g" or "s") known by the name server. */
+static int count_servers(XPA xpa, const char* apt, const char* type)
+{
+    char** classes = NULL;
+    char** names = NULL;
+    char** methods = NULL;
+    char** infos = NULL;
+    int i, n;
+    n = XPANSLookup(xpa, (char*)apt, (char*)type,
+                    &classes, &names, &methods, &infos);
+    for (i = 0; i < n; ++i) {
+        free(classes[i]);
+        free(names[i]);
+        free(methods[i]);
+        free(infos[i]);
+    }
+    free(classes);
+    free(names);
+    free(methods);
+    free(infos);
+    return (n > 0 ? n : 0);
+}
+
+/* Resolves the maximum number of recipients when `nmax=-1` has been
+   specified by counting the matching access points known by the name
+   server. */
+static void resolve_nmax(params_t* p, int set)
+{
+    if (p->nmax < 0) {
+        XPA xpa = get_handle(p);
+        int n = count_servers(xpa, p->apt, (set ? "s" : "g"));
+        p->nmax = (n > 1 ? n : 1);
+    }
+}
+
+static int access_by_worker(xpaconn_t* obj, const char* apt, int set,
+                            int nmax, replies_t* r);
+
+/* Checks access to `apt` with the connection `obj` for XPA get and XPA set
+   commands (so that get-only and set-only access points are both warmed)
+   and for at most `nmax` servers per access type (all matching servers if
+   `nmax` is -1).  The name server lookups and the connections to the
+   servers are thus done beforehand.  Yields the number of servers which can
+   be reached (-1 on error).  If `alive` is not NULL, it is set with whether
+   all the servers resolved by the name server can be reached.  For a
+   connection with a method, this is done by its transfer process. */
+static int preconnect(xpaconn_t* obj, const char* apt, int nmax, int* alive)
+{
+    static char* types[] = {"g", "s"};
+    replies_t r = {NULL, NULL, NULL, NULL, 0, 0};
+    int i, k, n, ok, count, best = 0, total = 0, all = 1;
+
+    for (k = 0; k < 2; ++k) {
+        if (obj->pool != NULL) {
+            count = access_by_worker(obj, apt, k, nmax, &r);
+        } else {
+            count = count_servers(obj->xpa, apt, types[k]);
+            if (nmax > 0 && count > nmax) {
+                count = nmax;
+            }
+            if (count >= 1) {
+                if (reserve_replies(&r, count) != 0) {
+                    free_replies(&r);
+                    return -1;
+                }
+                n = XPAAccess(obj->xpa, (char*)apt, types[k],
+                              default_mode(), r.srvs, r.msgs, count);
+                r.count = (n > 0 ? n : 0);
+            }
+        }
+        if (count < 1) {
+            clear_replies(&r);
+            continue;
+        }
+        total += count;
+        ok = 0;
+        for (i = 0; i < r.count; ++i) {
+            if (r.msgs[i] == NULL || ! IS_ERROR(r.msgs[i])) {
+                ++ok;
+            }
+        }
+        clear_replies(&r);
+        if (ok < count) {
+            all = 0;
+        }
+        if (ok > best) {
+            best = ok;
+        }
+    }
+    free_replies(&r);
+    if (alive != NULL) {
+        *alive = (all && total > 0);
+    }
+    return best;
+}
+
+/*---------------------------------------------------------------------------*/
+/* RESOLVER CACHE */
+
+/* When enabled, the address of an access point template that resolves to a
+   single server is looked up once with XPANSLookup and the concrete method
+   (e.g. "7f000001:40765" or a unix socket path) is used as the template of
+   subsequent calls so that XPA does not query the name server again.  An
+   entry is forgotten as soon as a transfer using it fails. */
+
+#define RESOLVER_TABLE 64 /* number of slots in the hash table */
+
+typedef struct resolver_entry resolver_entry_t;
+struct resolver_entry {
+    resolver_entry_t* next;
+    char* apt;    /* access point template */
+    char* method; /* concrete address of the server */
+    int   set;    /* resolved for XPA set commands? */
+};
+
+static resolver_entry_t* resolver_table[RESOLVER_TABLE];
+static int  resolver_enabled = 0;
+static long resolver_entries = 0;
+static long resolver_hits = 0;
+static long resolver_misses = 0;
+static long resolver_failures = 0;
+
+static unsigned long hash_string(unsigned long h, const char* str);
+
+static void free_resolver_entry(resolver_entry_t* e)
+{
+    free(e->apt);
+    free(e->method);
+    free(e);
+}
+
+static void reset_resolver()
+{
+    resolver_entry_t* e;
+    int k;
+    for (k = 0; k < RESOLVER_TABLE; ++k) {
+        while ((e = resolver_table[k]) != NULL) {
+            resolver_table[k] = e->next;
+            free_resolver_entry(e);
+        }
+    }
+    resolver_entries = 0;
+    resolver_hits = 0;
+    resolver_misses = 0;
+    resolver_failures = 0;
+}
+
+static resolver_entry_t** resolver_slot(const char* apt, int set)
+{
+    unsigned long h = hash_string(2166136261UL, apt);
+    return &resolver_table[(h + set)%RESOLVER_TABLE];
+}
+
+/* Yields the template to use for a single access point command: the cached
+   address of the server if `p->apt` resolves to a unique server, `p->apt`
+   otherwise. */
+static const char* resolve_apt(const params_t* p, int set)
+{
+    resolver_entry_t* e;
+    resolver_entry_t** slot;
+    char** classes = NULL;
+    char** names = NULL;
+    char** methods = NULL;
+    char** infos = NULL;
+    int i, n;
+
+    if (! resolver_enabled || p->nmax != 1) {
+        return p->apt;
+    }
+    slot = resolver_slot(p->apt, set);
+    for (e = *slot; e != NULL; e = e->next) {
+        if (e->set == set && strcmp(e->apt, p->apt) == 0) {
+            ++resolver_hits;
+            return e->method;
+        }
+    }
+    ++resolver_misses;
+    n = XPANSLookup(get_handle(p), p->apt, (set ? "s" : "g"),
+                    &classes, &names, &methods, &infos);
+    e = NULL;
+    if (n == 1 && methods[0] != NULL &&
+        (e = (resolver_entry_t*)malloc(sizeof(resolver_entry_t))) != NULL) {
+        e->apt = strdup(p->apt);
+        e->method = methods[0];
+        methods[0] = NULL;
+        e->set = set;
+        if (e->apt == NULL) {
+            free_resolver_entry(e);
+            e = NULL;
+        } else {
+            e->next = *slot;
+            *slot = e;
+            ++resolver_entries;
+        }
+    }
+    for (i = 0; i < n; ++i) {
+        free(classes[i]);
+        free(names[i]);
+        free(methods[i]);
+        free(infos[i]);
+    }
+    free(classes);
+    free(names);
+    free(methods);
+    free(infos);
+    return (e != NULL ? e->method : p->apt);
+}
+
+/* Forgets the cached address `method` if the `n` replies in `r` show that
+   the transfer failed. */
+static void check_resolved(const params_t* p, int set, const char* method,
+                           const replies_t* r, int n)
+{
+    resolver_entry_t* e;
+    resolver_entry_t** prev;
+    int i, failed = (n < 1);
+
+    if (method == p->apt) {
+        return;
+    }
+    for (i = 0; i < n && ! failed; ++i) {
+        failed = (r->msgs[i] != NULL && IS_ERROR(r->msgs[i]));
+    }
+    if (! failed) {
+        return;
+    }
+    ++resolver_failures;
+    prev = resolver_slot(p->apt, set);
+    for (e = *prev; e != NULL; prev = &e->next, e = e->next) {
+        if (e->method == method) {
+            *prev = e->next;
+            free_resolver_entry(e);
+            --resolver_entries;
+            break;
+        }
+    }
+}
+
+void Y__xpa_resolver(int argc)
+{
+    long dims[2];
+    long* ans;
+
+    if (argc > 2) {
+        y_error("expecting at most 2 arguments");
+    }
+    if (argc >= 2 && yarg_true(argc - 2)) {
+        reset_resolver();
+    }
+    if (argc >= 1 && ! yarg_nil(argc - 1)) {
+        resolver_enabled = yarg_true(argc - 1);
+        if (! resolver_enabled) {
+            long hits = resolver_hits, misses = resolver_misses;
+            long failures = resolver_failures;
+            reset_resolver();
+            resolver_hits = hits;
+            resolver_misses = misses;
+            resolver_failures = failures;
+        }
+    }
+    dims[0] = 1;
+    dims[1] = 5;
+    ans = ypush_l(dims);
+    ans[0] = resolver_enabled;
+    ans[1] = resolver_entries;
+    ans[2] = resolver_hits;
+    ans[3] = resolver_misses;
+    ans[4] = resolver_failures;
+}
+
+/*---------------------------------------------------------------------------*/
+/* STATISTICS */
+
+/* When enabled, each call to `xpa_get` or `xpa_set` is timed and accounted
+   in an entry identified by the access point and the command.  The elapsed
+   time is split in 4 phases: argument parsing, connection (including the
+   name server lookup for `nmax=-1`), XPA transfer and building of the
+   result.  When disabled, the overhead is a single test per phase. */
+
+#define STATS_TABLE   64 /* number of slots in the hash table */
+
+#define PHASE_PARSE    0
+#define PHASE_CONNECT  1
+#define PHASE_TRANSFER 2
+#define PHASE_PUSH     3
+#define PHASES         4
+
+/* Durations are accounted in a log-bucketed histogram with HIST_SUB linear
+   sub-buckets per octave from HIST_MIN seconds, so that quantiles have a
+   relative precision better than 1/HIST_SUB with a fixed memory. */
+#define HIST_MIN     1e-6
+#define HIST_SUB        8
+#define HIST_OCTAVES   32
+#define HIST_BUCKETS (HIST_SUB*HIST_OCTAVES)
+
+typedef struct hist {
+    unsigned long counts[HIST_BUCKETS];
+} hist_t;
+
+typedef struct stats_entry stats_entry_t;
+struct stats_entry {
+    stats_entry_t* next;   /* next entry in hash table slot */
+    unsigned long  hash;   /* hash code of access point and command */
+    char*          apt;    /* access point */
+    char*          cmd;    /* command */
+    long           calls;  /* number of calls */
+    long           errors; /* number of error replies */
+    long           replies;/* number of replies */
+    double         bytes_in;  /* number of bytes received */
+    double         bytes_out; /* number of bytes sent */
+    double         tmin;   /* minimum call duration */
+    double         tmax;   /* maximum call duration */
+    double         tsum;   /* sum of call durations */
+    double         phases[PHASES]; /* cumulated durations of phases */
+    hist_t         hist;   /* histogram of call durations */
+};
+
+static stats_entry_t* stats_table[STATS_TABLE];
+static long stats_count = 0; /* number of entries */
+static volatile int stats_enabled = 0;
+static int timing = 0; /* time calls for statistics, trace log or capture? */
+static void update_timing();
+static double stats_times[PHASES + 1]; /* start times of phases */
+
+#define STATS_MARK(k) \
+    do { if (timing) stats_times[k] = stats_clock(); } while (0)
+
+static double stats_clock()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + 1e-9*ts.tv_nsec;
+}
+
+static int hist_index(double t)
+{
+    int e, k;
+    double m = frexp(t/HIST_MIN, &e); /* t/HIST_MIN = m*2^e, 0.5 <= m < 1 */
+    if (t < HIST_MIN) {
+        return 0;
+    }
+    k = (e - 1)*HIST_SUB + (int)((2.0*m - 1.0)*HIST_SUB);
+    return (k < HIST_BUCKETS ? k : HIST_BUCKETS - 1);
+}
+
+/* Yields the value at the center of bucket `k`. */
+static double hist_value(int k)
+{
+    int e = k/HIST_SUB, s = k%HIST_SUB;
+    return ldexp(HIST_MIN*(1.0 + (s + 0.5)/HIST_SUB), e);
+}
+
+/* Histograms may be updated by several threads, incrementing or clearing a
+   bucket is an atomic operation so no locks are needed. */
+static void hist_add(hist_t* h, double t)
+{
+#ifdef __GNUC__
+    __sync_fetch_and_add(&h->counts[hist_index(t)], 1UL);
+#else
+    ++h->counts[hist_index(t)];
+#endif
+}
+
+static void hist_clear(hist_t* h)
+{
+    int k;
+    for (k = 0; k < HIST_BUCKETS; ++k) {
+#ifdef __GNUC__
+        __sync_lock_test_and_set(&h->counts[k], 0UL);
+#else
+        h->counts[k] = 0;
+#endif
+    }
+}
+
+/* Yields the quantile `q` (in [0,1]) of the durations in the histogram, 0 if
+   empty. */
+static double hist_quantile(const hist_t* h, double q)
+{
+    unsigned long total = 0, sum = 0, rank;
+    int k;
+    for (k = 0; k < HIST_BUCKETS; ++k) {
+        total += h->counts[k];
+    }
+    if (total == 0) {
+        return 0.0;
+    }
+    rank = (unsigned long)ceil(q*total);
+    if (rank < 1) {
+        rank = 1;
+    }
+    for (k = 0; k < HIST_BUCKETS; ++k) {
+        sum += h->counts[k];
+        if (sum >= rank) {
+            break;
+        }
+    }
+    return hist_value(k);
+}
+
+/* FNV-1a hash of a string. */
+static unsigned long hash_string(unsigned long h, const char* str)
+{
+    if (str != NULL) {
+        while (*str != '\0') {
+            h = (h ^ (unsigned char)*str++)*16777619UL;
+        }
+    }
+    return h;
+}
+
+static stats_entry_t* get_stats_entry(const char* apt, const char* cmd)
+{
+    stats_entry_t* e;
+    unsigned long h;
+
+    if (cmd == NULL) {
+        cmd = "";
+    }
+    h = hash_string(hash_string(2166136261UL, apt), cmd);
+    for (e = stats_table[h%STATS_TABLE]; e != NULL; e = e->next) {
+        if (e->hash == h && strcmp(e->apt, apt) == 0 &&
+            strcmp(e->cmd, cmd) == 0) {
+            return e;
+        }
+    }
+    e = (stats_entry_t*)calloc(1, sizeof(stats_entry_t));
+    if (e == NULL) {
+        return NULL;
+    }
+    e->apt = strdup(apt);
+    e->cmd = strdup(cmd);
+    if (e->apt == NULL || e->cmd == NULL) {
+        free(e->apt);
+        free(e->cmd);
+        free(e);
+        return NULL;
+    }
+    e->hash = h;
+    e->next = stats_table[h%STATS_TABLE];
+    stats_table[h%STATS_TABLE] = e;
+    ++stats_count;
+    return e;
+}
+
+/* The durations of the XPA transfers (XPAGet, XPASet, etc.) are always
+   accounted (whether statistics are enabled or not, it only costs reading
+   the clock) per access point in a fixed size table of histograms, whatever
+   the thread doing the transfer.  Entries are claimed by an atomic
+   compare-and-swap of their name and are never released (resetting the
+   statistics only clears the histograms) so no locks are needed.  When the
+   table is full, the transfers with other access points are accounted
+   together in an extra entry named LATENCY_OTHER. */
+
+#define LATENCY_SLOTS 64 /* maximum number of access points */
+#define LATENCY_OTHER "(other)"
+
+typedef struct latency {
+    char* volatile apt; /* access point (NULL if slot unused) */
+    hist_t hist;        /* histogram of transfer durations */
+} latency_t;
+
+static latency_t latency_table[LATENCY_SLOTS];
+static latency_t latency_other; /* access points not fitting in the table */
+
+/* Yields the histogram entry of an access point, creating it if `create` is
+   true (the LATENCY_OTHER entry is returned if the table is full).  Returns
+   NULL if not found. */
+static latency_t* get_latency(const char* apt, int create)
+{
+    unsigned long h = hash_string(2166136261UL, apt);
+    latency_t* l;
+    char* name;
+    char* cpy;
+    int k;
+
+    for (k = 0; k < LATENCY_SLOTS; ++k) {
+        l = &latency_table[(h + k)%LATENCY_SLOTS];
+        name = l->apt;
+        if (name == NULL) {
+            if (! create || (cpy = strdup(apt)) == NULL) {
+                return NULL;
+            }
+#ifdef __GNUC__
+            if (__sync_bool_compare_and_swap(&l->apt, NULL, cpy)) {
+                return l;
+            }
+#else
+            if (l->apt == NULL) {
+                l->apt = cpy;
+                return l;
+            }
+#endif
+            free(cpy);
+            name = l->apt;
+        }
+        if (strcmp(name, apt) == 0) {
+            return l;
+        }
+    }
+    if (create) {
+        latency_other.apt = LATENCY_OTHER;
+        return &latency_other;
+    }
+    if (latency_other.apt != NULL && strcmp(apt, LATENCY_OTHER) == 0) {
+        return &latency_other;
+    }
+    return NULL;
+}
+
+/* Yields the start time of a transfer. */
+static double latency_start()
+{
+    return stats_clock();
+}
+
+/* Accounts a transfer of duration `t`. */
+static void latency_add(const char* apt, double t)
+{
+    latency_t* l = get_latency(apt, 1);
+    if (l != NULL) {
+        hist_add(&l->hist, t);
+    }
+}
+
+/* Accounts the duration of a transfer started at `t0`. */
+static void latency_record(const char* apt, double t0)
+{
+    if (t0 > 0.0 && apt != NULL) {
+        latency_add(apt, stats_clock() - t0);
+    }
+}
+
+static void reset_stats()
+{
+    stats_entry_t* e;
+    int k;
+    for (k = 0; k < STATS_TABLE; ++k) {
+        while ((e = stats_table[k]) != NULL) {
+            stats_table[k] = e->next;
+            free(e->apt);
+            free(e->cmd);
+            free(e);
+        }
+    }
+    stats_count = 0;
+    for (k = 0; k < LATENCY_SLOTS; ++k) {
+        hist_clear(&latency_table[k].hist);
+    }
+    hist_clear(&latency_other.hist);
+}
+
+/*---------------------------------------------------------------------------*/
+/* TRACE LOG */
+
+/* When enabled, the last calls to `xpa_get` and `xpa_set` are recorded in a
+   ring buffer of fixed size entries (long names are truncated). */
+
+#define TRACE_NAME 64 /* maximum size of names in the trace log */
+
+typedef struct trace_entry {
+    double start;    /* start time (seconds since the Epoch) */
+    double duration; /* duration of the call (seconds) */
+    long   size;     /* number of bytes sent or received */
+    int    replies;  /* number of replies */
+    int    errors;   /* number of error replies */
+    int    set;      /* XPA set command? */
+    char   apt[TRACE_NAME]; /* access point(s) */
+    char   cmd[TRACE_NAME]; /* command */
+} trace_entry_t;
+
+static trace_entry_t* trace_log = NULL;
+static long trace_capacity = 0; /* size of ring buffer */
+static long trace_count = 0; /* number of recorded entries */
+static long trace_next = 0; /* index of next entry to record */
+static double trace_offset = 0.0; /* real-time minus monotonic clock */
+
+static void copy_name(char* dst, const char* src)
+{
+    size_t n = (src == NULL ? 0 : strlen(src));
+    if (n >= TRACE_NAME) {
+        n = TRACE_NAME - 1;
+    }
+    memcpy(dst, src, n);
+    dst[n] = '\0';
+}
+
+static void trace_call(const char* apt, const char* cmd, int set,
+                       long size, int replies, int errors)
+{
+    trace_entry_t* e = &trace_log[trace_next];
+    e->start = stats_times[0] + trace_offset;
+    e->duration = stats_times[PHASES] - stats_times[0];
+    e->size = size;
+    e->replies = replies;
+    e->errors = errors;
+    e->set = set;
+    copy_name(e->apt, apt);
+    copy_name(e->cmd, cmd);
+    trace_next = (trace_next + 1)%trace_capacity;
+    if (trace_count < trace_capacity) {
+        ++trace_count;
+    }
+}
+
+/* Yields the `k`-th recorded entry (oldest first). */
+static trace_entry_t* trace_entry(long k)
+{
+    return &trace_log[(trace_next - trace_count + k + trace_capacity)
+                      %trace_capacity];
+}
+
+void Y__xpa_trace_config(int argc)
+{
+    struct timespec ts;
+    trace_entry_t* log;
+    long size;
+
+    if (argc != 1) {
+        y_error("expecting exactly 1 argument");
+    }
+    if (! yarg_nil(0)) {
+        size = ygets_l(0);
+        if (size < 0) {
+            y_error("invalid trace log size");
+        }
+        log = NULL;
+        if (size > 0) {
+            log = (trace_entry_t*)malloc(size*sizeof(trace_entry_t));
+            if (log == NULL) {
+                y_error("insufficient memory for trace log");
+            }
+        }
+        free(trace_log);
+        trace_log = log;
+        trace_capacity = size;
+        trace_count = 0;
+        trace_next = 0;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        trace_offset = (ts.tv_sec + 1e-9*ts.tv_nsec) - stats_clock();
+        update_timing();
+    }
+    ypush_long(trace_capacity);
+}
+
+void Y__xpa_trace(int argc)
+{
+    long dims[3];
+    long refs[3];
+    trace_entry_t* e;
+    double* times;
+    char** names;
+    long* counts;
+    long k, n = trace_count;
+    int iarg;
+
+    if (argc != 3) {
+        y_error("expecting exactly 3 arguments");
+    }
+    for (iarg = argc - 1; iarg >= 0; --iarg) {
+        refs[argc - 1 - iarg] = yget_ref(iarg);
+        if (refs[argc - 1 - iarg] < 0) {
+            y_error("expecting simple variables");
+        }
+    }
+    if (n > 0) {
+        dims[0] = 2;
+        dims[1] = 2;
+        dims[2] = n;
+        times = ypush_d(dims);
+        names = ypush_q(dims);
+        dims[1] = 4;
+        counts = ypush_l(dims);
+        for (k = 0; k < n; ++k) {
+            e = trace_entry(k);
+            times[2*k + 0] = e->start;
+            times[2*k + 1] = e->duration;
+            names[2*k + 0] = p_strcpy(e->apt);
+            names[2*k + 1] = p_strcpy(e->cmd);
+            counts[4*k + 0] = e->set;
+            counts[4*k + 1] = e->size;
+            counts[4*k + 2] = e->replies;
+            counts[4*k + 3] = e->errors;
+        }
+        for (k = 0; k < 3; ++k) {
+            yput_global(refs[k], 2 - k);
+        }
+    } else {
+        ypush_nil();
+        for (k = 0; k < 3; ++k) {
+            yput_global(refs[k], 0);
+        }
+    }
+    ypush_long(n);
+}
+
+/* Writes a JSON string with escaped characters. */
+static void write_json_string(FILE* file, const char* str)
+{
+    fputc('"', file);
+    for (; *str != '\0'; ++str) {
+        unsigned char c = *str;
+        if (c == '"' || c == '\\') {
+            fputc('\\', file);
+            fputc(c, file);
+        } else if (c < 0x20) {
+            fprintf(file, "\\u%04x", c);
+        } else {
+            fputc(c, file);
+        }
+    }
+    fputc('"', file);
+}
+
+/* Saves the trace log in the Chrome trace event format (a JSON file which
+   can be loaded by chrome://tracing or Perfetto). */
+void Y_xpa_trace_save(int argc)
+{
+    trace_entry_t* e;
+    FILE* file;
+    char* path;
+    long k;
+
+    if (argc != 1) {
+        y_error("expecting exactly 1 argument");
+    }
+    path = ygets_q(0);
+    file = (path == NULL ? NULL : fopen(path, "w"));
+    if (file == NULL) {
+        y_error("cannot create trace file");
+    }
+    fputs("{\"traceEvents\":[", file);
+    for (k = 0; k < trace_count; ++k) {
+        e = trace_entry(k);
+        fputs((k > 0 ? ",\n" : "\n"), file);
+        fputs("{\"name\":", file);
+        write_json_string(file, e->cmd[0] != '\0' ? e->cmd :
+                          (e->set ? "set" : "get"));
+        fprintf(file, ",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,"
+                "\"dur\":%.3f,\"pid\":1,\"tid\":1,\"args\":{\"apt\":",
+                (e->set ? "xpa_set" : "xpa_get"), 1e6*e->start,
+                1e6*e->duration);
+        write_json_string(file, e->apt);
+        fputs(",\"cmd\":", file);
+        write_json_string(file, e->cmd);
+        fprintf(file, ",\"size\":%ld,\"replies\":%d,\"errors\":%d}}",
+                e->size, e->replies, e->errors);
+    }
+    fputs("\n],\"displayTimeUnit\":\"ms\"}\n", file);
+    if (fclose(file) != 0) {
+        y_error("failed to write trace file");
+    }
+}
+
+/*---------------------------------------------------------------------------*/
+/* CAPTURE AND REPLAY */
+
+/* When capturing, each call to `xpa_get` and `xpa_set` is appended to a
+   binary file as a fixed size record header followed by the access point,
+   the command and the data sent (for XPA set commands).  Replies are
+   summarized by their number, number of errors and total size.  The file
+   starts with a magic string and a byte order mark, values are written with
+   the native byte order.  Fan-out calls yield one record per access point
+   with unknown replies (-1). */
+
+#define CAPTURE_MAGIC "YXPACAP1"
+#define CAPTURE_BOM   0x01020304U
+
+typedef struct capture_record {
+    double   time;     /* start time relative to beginning of capture (s) */
+    double   duration; /* duration of the call (s) */
+    uint64_t len;      /* size of data sent */
+    uint64_t size;     /* total size of data received */
+    uint32_t aptlen;   /* length of access point name */
+    uint32_t cmdlen;   /* length of command */
+    int32_t  set;      /* XPA set command? */
+    int32_t  nmax;     /* maximum number of recipients */
+    int32_t  replies;  /* number of replies */
+    int32_t  errors;   /* number of error replies */
+} capture_record_t;
+
+static FILE* capture_file = NULL;
+static double capture_origin = 0.0; /* start time of capture */
+static long capture_count = 0; /* number of captured calls */
+
+static void update_timing()
+{
+    timing = (stats_enabled || trace_capacity > 0 || capture_file != NULL);
+}
+
+static void stop_capture()
+{
+    if (capture_file != NULL) {
+        FILE* file = capture_file;
+        capture_file = NULL;
+        update_timing();
+        if (fclose(file) != 0) {
+            y_error("failed to write capture file");
+        }
+    }
+}
+
+/* Writes a call in the capture file.  Yields 0 on success, -1 on error (the
+   capture is then stopped). */
+static int capture_call(const char* apt, const char* cmd, int set,
+                        int nmax, const char* buf, size_t len,
+                        double size, int replies, int errors)
+{
+    capture_record_t rec;
+    memset(&rec, 0, sizeof(rec));
+    rec.time = stats_times[0] - capture_origin;
+    rec.duration = stats_times[PHASES] - stats_times[0];
+    rec.len = (set ? len : 0);
+    rec.size = (size > 0.0 ? (uint64_t)size : 0);
+    rec.aptlen = strlen(apt);
+    rec.cmdlen = (cmd == NULL ? 0 : strlen(cmd));
+    rec.set = set;
+    rec.nmax = nmax;
+    rec.replies = replies;
+    rec.errors = errors;
+    if (fwrite(&rec, sizeof(rec), 1, capture_file) != 1 ||
+        fwrite(apt, 1, rec.aptlen, capture_file) != rec.aptlen ||
+        (rec.cmdlen > 0 &&
+         fwrite(cmd, 1, rec.cmdlen, capture_file) != rec.cmdlen) ||
+        (rec.len > 0 && fwrite(buf, 1, len, capture_file) != len)) {
+        stop_capture();
+        return -1;
+    }
+    ++capture_count;
+    return 0;
+}
+
+void Y_xpa_capture(int argc)
+{
+    uint32_t bom = CAPTURE_BOM;
+    const char* path;
+    FILE* file;
+    long count = capture_count;
+
+    if (argc > 1) {
+        y_error("expecting at most 1 argument");
+    }
+    path = (argc < 1 || yarg_nil(0) ? NULL : ygets_q(0));
+    stop_capture();
+    capture_count = 0;
+    if (path != NULL && path[0] != '\0') {
+        file = fopen(path, "wb");
+        if (file == NULL) {
+            y_error("cannot create capture file");
+        }
+        if (fwrite(CAPTURE_MAGIC, 1, 8, file) != 8 ||
+            fwrite(&bom, sizeof(bom), 1, file) != 1) {
+            fclose(file);
+            y_error("failed to write capture file");
+        }
+        capture_file = file;
+        capture_origin = stats_clock();
+        update_timing();
+    }
+    ypush_long(count);
+}
+
+/* Reads `n` bytes from `file` into a growing buffer. */
+static char* read_field(FILE* file, char** buf, size_t* size, size_t n)
+{
+    if (n + 1 > *size) {
+        char* ptr = realloc(*buf, n + 1);
+        if (ptr == NULL) {
+            return NULL;
+        }
+        *buf = ptr;
+        *size = n + 1;
+    }
+    if (n > 0 && fread(*buf, 1, n, file) != n) {
+        return NULL;
+    }
+    (*buf)[n] = '\0';
+    return *buf;
+}
+
+typedef struct replayer {
+    FILE*  file;
+    char*  apt;
+    char*  cmd;
+    char*  data;
+    size_t aptsize, cmdsize, datasize;
+    replies_t rep;
+    hist_t hist; /* histogram of durations */
+} replayer_t;
+
+static void free_replayer(void* addr)
+{
+    replayer_t* obj = (replayer_t*)addr;
+    if (obj->file != NULL) {
+        fclose(obj->file);
+    }
+    free(obj->apt);
+    free(obj->cmd);
+    free(obj->data);
+    free_replies(&obj->rep);
+}
+
+static y_userobj_t replayer_type = {
+    "XPAReplayer",
+    free_replayer,
+    NULL,
+    NULL,
+    NULL,
+    NULL
+};
+
+/* Waits until the monotonic clock reaches `t` checking for interrupts. */
+static void wait_until(double t)
+{
+    struct timespec ts;
+    double dt;
+    while ((dt = t - stats_clock()) > 0.0) {
+        if (dt > 0.1) {
+            dt = 0.1;
+        }
+        ts.tv_sec = (time_t)dt;
+        ts.tv_nsec = (long)((dt - ts.tv_sec)*1e9);
+        nanosleep(&ts, NULL);
+        if (p_signalling) {
+            p_abort();
+        }
+    }
+}
+
+void Y_xpa_replay(int argc)
+{
+    char magic[8];
+    capture_record_t rec;
+    replayer_t* obj;
+    replies_t* r;
+    double speed = 1.0, t0, t1, start, elapsed, bytes = 0.0, tsum = 0.0;
+    double tmax = 0.0, *res;
+    const char* path = NULL;
+    const char* target = NULL;
+    char* cmd;
+    long index, calls = 0, errors = 0, mismatches = 0, dims[2];
+    uint32_t bom;
+    int iarg, npos = 0, i, n;
+
+    for (iarg = argc - 1; iarg >= 0; --iarg) {
+        index = yarg_key(iarg);
+        if (index == -1) {
+            if (++npos == 1) {
+                path = ygets_q(iarg);
+            } else if (npos == 2) {
+                target = (yarg_nil(iarg) ? NULL : ygets_q(iarg));
+            } else {
+                y_error("too many arguments");
+            }
+        } else {
+            --iarg;
+            if (index_of_speed < 0) {
+                initialize_indices();
+            }
+            if (index == index_of_speed) {
+                if (! yarg_nil(iarg)) {
+                    speed = ygets_d(iarg);
+                    if (speed < 0.0) {
+                        y_error("invalid replay speed");
+                    }
+                }
+            } else {
+                y_error("unknown keyword");
+            }
+        }
+    }
+    if (path == NULL) {
+        y_error("expecting a capture file name");
+    }
+
+    /* Open the capture file in an object so that resources are released in
+       case of errors. */
+    obj = (replayer_t*)ypush_obj(&replayer_type, sizeof(replayer_t));
+    obj->file = fopen(path, "rb");
+    if (obj->file == NULL) {
+        y_error("cannot open capture file");
+    }
+    if (fread(magic, 1, 8, obj->file) != 8 ||
+        memcmp(magic, CAPTURE_MAGIC, 8) != 0 ||
+        fread(&bom, sizeof(bom), 1, obj->file) != 1) {
+        y_error("not a capture file");
+    }
+    if (bom != CAPTURE_BOM) {
+        y_error("capture file has a different byte order");
+    }
+    if (client == NULL) {
+        connect_client();
+    }
+
+    /* Replay the calls. */
+    r = &obj->rep;
+    start = stats_clock();
+    while (fread(&rec, sizeof(rec), 1, obj->file) == 1) {
+        if (read_field(obj->file, &obj->apt, &obj->aptsize,
+                       rec.aptlen) == NULL ||
+            read_field(obj->file, &obj->cmd, &obj->cmdsize,
+                       rec.cmdlen) == NULL ||
+            read_field(obj->file, &obj->data, &obj->datasize,
+                       rec.len) == NULL) {
+            y_error("truncated capture file");
+        }
+        if (speed > 0.0) {
+            wait_until(start + rec.time/speed);
+        } else if (p_signalling) {
+            p_abort();
+        }
+        n = (rec.nmax > 0 ? rec.nmax : (rec.replies > 0 ? rec.replies : 1));
+        clear_replies(r);
+        if (reserve_replies(r, n) != 0) {
+            y_error("insufficient memory");
+        }
+        /* A command of zero length was recorded for no command. */
+        cmd = (rec.cmdlen > 0 ? obj->cmd : NULL);
+        t0 = stats_clock();
+        if (rec.set) {
+            n = XPASet(client, (target != NULL ? (char*)target : obj->apt),
+                       cmd, default_mode(), obj->data, rec.len,
+                       r->srvs, r->msgs, n);
+        } else {
+            n = XPAGet(client, (target != NULL ? (char*)target : obj->apt),
+                       cmd, default_mode(), r->bufs, r->lens,
+                       r->srvs, r->msgs, n);
+        }
+        t1 = stats_clock();
+        r->count = (n > 0 ? n : 0);
+        hist_add(&obj->hist, t1 - t0);
+        tsum += t1 - t0;
+        if (t1 - t0 > tmax) {
+            tmax = t1 - t0;
+        }
+        ++calls;
+        if (rec.set) {
+            bytes += (double)rec.len*r->count;
+        } else {
+            double size = 0.0;
+            for (i = 0; i < r->count; ++i) {
+                if (r->bufs[i] != NULL) {
+                    size += r->lens[i];
+                }
+            }
+            bytes += size;
+            if (rec.replies >= 0 && size != (double)rec.size) {
+                ++mismatches;
+            }
+        }
+        if (rec.replies >= 0 && r->count != rec.replies) {
+            ++mismatches;
+        }
+        for (i = 0; i < r->count; ++i) {
+            if (r->msgs[i] != NULL && IS_ERROR(r->msgs[i])) {
+                ++errors;
+            }
+        }
+    }
+    elapsed = stats_clock() - start;
+    clear_replies(r);
+
+    /* Push the results. */
+    dims[0] = 1;
+    dims[1] = 10;
+    res = ypush_d(dims);
+    res[0] = calls;
+    res[1] = errors;
+    res[2] = mismatches;
+    res[3] = elapsed;
+    res[4] = bytes;
+    res[5] = (elapsed > 0.0 ? bytes/elapsed : 0.0);
+    res[6] = (calls > 0 ? tsum/calls : 0.0);
+    res[7] = hist_quantile(&obj->hist, 0.50);
+    res[8] = hist_quantile(&obj->hist, 0.99);
+    res[9] = tmax;
+}
+
+/*---------------------------------------------------------------------------*/
+/* ACCOUNTING OF CALLS */
+
+/* Accounts a call whose result (an XPAData object) is on top of the stack
+   and whose phases have been timed by STATS_MARK. */
+static void record_call(const params_t* p, int set)
+{
+    stats_entry_t* e;
+    xpadata_t* obj;
+    char* apt = p->apt;
+    char* tmp = NULL;
+    double t, size;
+    long i;
+    int k, errors, status = 0;
+
+    if (p->napts > 1) {
+        /* Fan-out calls are accounted under the list of access points. */
+        size_t len = 0;
+        for (i = 0; i < p->napts; ++i) {
+            len += strlen(p->apts[i]) + 1;
+        }
+        tmp = malloc(len);
+        if (tmp == NULL) {
+            return;
+        }
+        apt = tmp;
+        for (i = 0; i < p->napts; ++i) {
+            size_t n = strlen(p->apts[i]);
+            memcpy(apt, p->apts[i], n);
+            apt[n] = (i < p->napts - 1 ? ',' : '\0');
+            apt += n + 1;
+        }
+        apt = tmp;
+    }
+    obj = (xpadata_t*)yget_obj(0, &xpadata_type);
+    errors = get_errors(obj);
+    if (set) {
+        size = (double)p->len*obj->replies;
+    } else {
+        size = 0.0;
+        for (i = 0; i < obj->replies; ++i) {
+            size += obj->lens[i];
+        }
+    }
+    if (trace_capacity > 0) {
+        trace_call(apt, p->cmd, set, (long)size, obj->replies, errors);
+    }
+    if (capture_file != NULL) {
+        /* Errors are raised after having freed `tmp`. */
+        if (p->napts > 1) {
+            for (i = 0; i < p->napts && status == 0; ++i) {
+                status = capture_call(p->apts[i], p->cmd, set, p->nmax,
+                                      p->buf, p->len, 0.0, -1, -1);
+            }
+        } else {
+            status = capture_call(apt, p->cmd, set, p->nmax, p->buf, p->len,
+                                  size, obj->replies, errors);
+        }
+    }
+    e = (stats_enabled ? get_stats_entry(apt, p->cmd) : NULL);
+    free(tmp);
+    if (status != 0) {
+        y_error("failed to write capture file");
+    }
+    if (e == NULL) {
+        return;
+    }
+    t = stats_times[PHASES] - stats_times[0];
+    if (e->calls == 0 || t < e->tmin) {
+        e->tmin = t;
+    }
+    if (e->calls == 0 || t > e->tmax) {
+        e->tmax = t;
+    }
+    e->tsum += t;
+    ++e->calls;
+    for (k = 0; k < PHASES; ++k) {
+        e->phases[k] += stats_times[k + 1] - stats_times[k];
+    }
+    hist_add(&e->hist, t);
+    e->replies += obj->replies;
+    e->errors += errors;
+    if (set) {
+        e->bytes_out += size;
+    } else {
+        e->bytes_in += size;
+    }
+}
+
+void Y__xpa_stats_config(int argc)
+{
+    if (argc != 2) {
+        y_error("expecting exactly 2 arguments");
+    }
+    if (! yarg_nil(argc - 1)) {
+        stats_enabled = yarg_true(argc - 1);
+        update_timing();
+    }
+    if (yarg_true(argc - 2)) {
+        reset_stats();
+    }
+    ypush_int(stats_enabled);
+}
+
+void Y_xpa_latency(int argc)
+{
+    long dims[2];
+    latency_t* l;
+    const char* apt;
+    long ref1 = -1, ref2 = -1, n;
+    double* q;
+    int k;
+
+    if (argc < 1 || argc > 3) {
+        y_error("expecting 1 to 3 arguments");
+    }
+    if (argc >= 2 && (ref1 = yget_ref(argc - 2)) < 0) {
+        y_error("expecting a simple variable for the histogram");
+    }
+    if (argc >= 3 && (ref2 = yget_ref(argc - 3)) < 0) {
+        y_error("expecting a simple variable for the bucket bounds");
+    }
+    if (yarg_nil(argc - 1)) {
+        /* Yield the list of access points. */
+        n = (latency_other.apt != NULL);
+        for (k = 0; k < LATENCY_SLOTS; ++k) {
+            if (latency_table[k].apt != NULL) {
+                ++n;
+            }
+        }
+        if (n > 0) {
+            char** list;
+            dims[0] = 1;
+            dims[1] = n;
+            list = ypush_q(dims);
+            n = 0;
+            for (k = 0; k < LATENCY_SLOTS; ++k) {
+                if (latency_table[k].apt != NULL) {
+                    list[n++] = p_strcpy(latency_table[k].apt);
+                }
+            }
+            if (latency_other.apt != NULL) {
+                list[n++] = p_strcpy(latency_other.apt);
+            }
+        } else {
+            ypush_nil();
+        }
+        return;
+    }
+    apt = ygets_q(argc - 1);
+    l = (apt == NULL ? NULL : get_latency(apt, 0));
+    dims[0] = 1;
+    if (ref1 >= 0) {
+        long* counts;
+        dims[1] = HIST_BUCKETS;
+        counts = ypush_l(dims);
+        for (k = 0; k < HIST_BUCKETS; ++k) {
+            counts[k] = (l == NULL ? 0 : l->hist.counts[k]);
+        }
+        yput_global(ref1, 0);
+        yarg_drop(1);
+    }
+    if (ref2 >= 0) {
+        double* edges;
+        dims[1] = HIST_BUCKETS + 1;
+        edges = ypush_d(dims);
+        for (k = 0; k <= HIST_BUCKETS; ++k) {
+            edges[k] = ldexp(HIST_MIN*(1.0 + (double)(k%HIST_SUB)/HIST_SUB),
+                             k/HIST_SUB);
+        }
+        yput_global(ref2, 0);
+        yarg_drop(1);
+    }
+    dims[1] = 3;
+    q = ypush_d(dims);
+    q[0] = (l == NULL ? 0.0 : hist_quantile(&l->hist, 0.50));
+    q[1] = (l == NULL ? 0.0 : hist_quantile(&l->hist, 0.99));
+    q[2] = (l == NULL ? 0.0 : hist_quantile(&l->hist, 0.999));
+}
+
+void Y__xpa_stats(int argc)
+{
+    long dims[3];
+    long refs[4];
+    stats_entry_t* e;
+    char** apts;
+    char** cmds;
+    long* counts;
+    double* times;
+    long j, n = stats_count;
+    int iarg, k;
+
+    if (argc != 4) {
+        y_error("expecting exactly 4 arguments");
+    }
+    for (iarg = argc - 1; iarg >= 0; --iarg) {
+        refs[argc - 1 - iarg] = yget_ref(iarg);
+        if (refs[argc - 1 - iarg] < 0) {
+            y_error("expecting simple variables");
+        }
+    }
+    if (n > 0) {
+        dims[0] = 1;
+        dims[1] = n;
+        apts = ypush_q(dims);
+        cmds = ypush_q(dims);
+        dims[0] = 2;
+        dims[1] = 5;
+        dims[2] = n;
+        counts = ypush_l(dims);
+        dims[1] = 10;
+        times = ypush_d(dims);
+        j = 0;
+        for (k = 0; k < STATS_TABLE; ++k) {
+            for (e = stats_table[k]; e != NULL; e = e->next, ++j) {
+                double c = (e->calls > 0 ? e->calls : 1);
+                apts[j] = p_strcpy(e->apt);
+                cmds[j] = p_strcpy(e->cmd);
+                counts[5*j + 0] = e->calls;
+                counts[5*j + 1] = e->errors;
+                counts[5*j + 2] = e->replies;
+                counts[5*j + 3] = (long)e->bytes_in;
+                counts[5*j + 4] = (long)e->bytes_out;
+                times[10*j + 0] = e->tmin;
+                times[10*j + 1] = e->tsum/c;
+                times[10*j + 2] = e->tmax;
+                times[10*j + 3] = hist_quantile(&e->hist, 0.50);
+                times[10*j + 4] = hist_quantile(&e->hist, 0.90);
+                times[10*j + 5] = hist_quantile(&e->hist, 0.99);
+                times[10*j + 6] = e->phases[PHASE_PARSE]/c;
+                times[10*j + 7] = e->phases[PHASE_CONNECT]/c;
+                times[10*j + 8] = e->phases[PHASE_TRANSFER]/c;
+                times[10*j + 9] = e->phases[PHASE_PUSH]/c;
+            }
+        }
+        for (k = 0; k < 4; ++k) {
+            yput_global(refs[k], 3 - k);
+        }
+    } else {
+        ypush_nil();
+        for (k = 0; k < 4; ++k) {
+            yput_global(refs[k], 0);
+        }
+    }
+    ypush_long(n);
+}
+
+static void fanout(params_t* p, int set);
+
+void Y_xpa_get(int argc)
+{
+    XPA xpa;
+    replies_t* r;
+    params_t p;
+    const char* apt;
+    double t0;
+    int n;
+
+    /* Parse arguments. */
+    STATS_MARK(PHASE_PARSE);
+    parse_params(argc, 0, &p);
+    STATS_MARK(PHASE_CONNECT);
+    if (p.napts > 1 || p.lane != LANE_CONTROL) {
+        fanout(&p, 0);
+        if (timing) {
+            /* All phases of a fan-out are accounted as transfer. */
+            stats_times[PHASE_TRANSFER] = stats_times[PHASE_CONNECT];
+            STATS_MARK(PHASE_PUSH);
+            stats_times[PHASES] = stats_times[PHASE_PUSH];
+            record_call(&p, 0);
+        }
+        return;
+    }
+    begin_timeout(&p);
+    resolve_nmax(&p, 0);
+    apt = resolve_apt(&p, 0);
+
+    /* Evaluate the XPA get command. */
+    xpa = get_handle(&p);
+    r = get_shared_replies(p.nmax);
+    STATS_MARK(PHASE_TRANSFER);
+    t0 = latency_start();
+    n = XPAGet(xpa, (char*)apt, p.cmd, MODE(&p),
+               r->bufs, r->lens, r->srvs, r->msgs, p.nmax);
+    latency_record(p.apt, t0);
+    end_timeout();
+    check_resolved(&p, 0, apt, r, n);
+    r->count = (n > 0 ? n : 0);
+    for (n = 0; n < r->count; ++n) {
+        if (r->bufs[n] == NULL) {
+            r->lens[n] = 0;
+        }
+    }
+    STATS_MARK(PHASE_PUSH);
+    push_xpadata(r);
+    if (timing) {
+        STATS_MARK(PHASES);
+        record_call(&p, 0);
+    }
+}
+
+void Y_xpa_set(int argc)
+{
+    XPA xpa;
+    replies_t* r;
+    params_t p;
+    const char* apt;
+    double t0;
+    int n;
+
+    /* Parse arguments. */
+    STATS_MARK(PHASE_PARSE);
+    parse_params(argc, 1, &p);
+    STATS_MARK(PHASE_CONNECT);
+    if (p.napts > 1 || p.lane != LANE_CONTROL) {
+        fanout(&p, 1);
+        if (timing) {
+            /* All phases of a fan-out are accounted as transfer. */
+            stats_times[PHASE_TRANSFER] = stats_times[PHASE_CONNECT];
+            STATS_MARK(PHASE_PUSH);
+            stats_times[PHASES] = stats_times[PHASE_PUSH];
+            record_call(&p, 1);
+        }
+        return;
+    }
+    begin_timeout(&p);
+    resolve_nmax(&p, 1);
+    apt = resolve_apt(&p, 1);
+
+    /* Evaluate the XPA set command. */
+    xpa = get_handle(&p);
+    r = get_shared_replies(p.nmax);
+    STATS_MARK(PHASE_TRANSFER);
+    t0 = latency_start();
+    n = XPASet(xpa, (char*)apt, p.cmd, MODE(&p), p.buf, p.len,
+               r->srvs, r->msgs, p.nmax);
+    latency_record(p.apt, t0);
+    end_timeout();
+    check_resolved(&p, 1, apt, r, n);
+    r->count = (n > 0 ? n : 0);
+    STATS_MARK(PHASE_PUSH);
+    push_xpadata(r);
+    if (timing) {
+        STATS_MARK(PHASES);
+        record_call(&p, 1);
+    }
+}
+
+/*---------------------------------------------------------------------------*/
+/* LIST OF SERVERS */
+
+/* The list of access points known by the name server (as replied by
+   "xpans") is parsed in columns and cached so that frequent discovery does
+   not cost a name server round trip each time. */
+
+#define SERVER_COLUMNS 5 /* class, name, access, method, user */
+
+#ifndef FNM_CASEFOLD
+#  define FNM_CASEFOLD 0 /* XPA templates are case insensitive, if possible */
+#endif
+
+static char** server_list = NULL; /* cached table of strings */
+static long server_count = 0; /* number of rows in cached table */
+static double server_time = -1.0; /* time of last update */
+
+static void free_server_list()
+{
+    long i;
+    if (server_list != NULL) {
+        for (i = 0; i < SERVER_COLUMNS*server_count; ++i) {
+            free(server_list[i]);
+        }
+        free(server_list);
+        server_list = NULL;
+    }
+    server_count = 0;
+    server_time = -1.0;
+}
+
+/* Queries the name server and parses its reply into the cached table. */
+static void update_server_list()
+{
+    char* buf = NULL;
+    char* srv = NULL;
+    char* msg = NULL;
+    char** list;
+    size_t len = 0, i;
+    long nlines, row, col;
+    char* ptr;
+    char* end;
+
+    if (client == NULL) {
+        connect_client();
+    }
+    XPAGet(client, "xpans", NULL, default_mode(), &buf, &len, &srv, &msg, 1);
+    free(srv);
+    if (msg != NULL && IS_ERROR(msg)) {
+        free(buf);
+        push_string(msg, -1);
+        free(msg);
+        y_errorq("%s", ygets_q(0));
+    }
+    free(msg);
+
+    /* Count lines to allocate the table. */
+    nlines = 0;
+    for (i = 0; i < len; ++i) {
+        if (buf[i] == '\n' || i == len - 1) {
+            ++nlines;
+        }
+    }
+    list = (char**)calloc(SERVER_COLUMNS*(nlines > 0 ? nlines : 1),
+                          sizeof(char*));
+    if (list == NULL) {
+        free(buf);
+        y_error("insufficient memory");
+    }
+    free_server_list();
+    server_list = list;
+
+    /* Split lines in words, missing columns are left as null strings. */
+    row = 0;
+    ptr = buf;
+    end = buf + len;
+    while (ptr < end) {
+        char* eol = memchr(ptr, '\n', end - ptr);
+        if (eol == NULL) {
+            eol = end;
+        }
+        col = 0;
+        while (ptr < eol) {
+            char* word;
+            while (ptr < eol && (*ptr == ' ' || *ptr == '\t' ||
+                                 *ptr == '\r')) {
+                ++ptr;
+            }
+            word = ptr;
+            while (ptr < eol && *ptr != ' ' && *ptr != '\t' && *ptr != '\r') {
+                ++ptr;
+            }
+            if (ptr > word && col < SERVER_COLUMNS) {
+                char* str = (char*)malloc(ptr - word + 1);
+                if (str == NULL) {
+                    /* Release the rows parsed so far. */
+                    server_count = row + 1;
+                    free_server_list();
+                    free(buf);
+                    y_error("insufficient memory");
+                }
+                memcpy(str, word, ptr - word);
+                str[ptr - word] = '\0';
+                list[SERVER_COLUMNS*row + col] = str;
+                ++col;
+            }
+        }
+        if (col > 0) {
+            ++row;
+        }
+        ptr = eol + 1;
+    }
+    free(buf);
+    server_count = row;
+    server_time = stats_clock();
+}
+
+/* Checks whether `class:name` matches the XPA template `tmpl` (a template
+   without a class matches any class). */
+static int match_server(const char* tmpl, const char* class,
+                        const char* name)
+{
+    const char* sep = strchr(tmpl, ':');
+    if (sep == NULL) {
+        return (name != NULL && fnmatch(tmpl, name, FNM_CASEFOLD) == 0);
+    } else {
+        char buf[256];
+        size_t n = sep - tmpl;
+        if (n >= sizeof(buf)) {
+            return 0;
+        }
+        memcpy(buf, tmpl, n);
+        buf[n] = '\0';
+        return (class != NULL && name != NULL &&
+                fnmatch(buf, class, FNM_CASEFOLD) == 0 &&
+                fnmatch(sep + 1, name, FNM_CASEFOLD) == 0);
+    }
+}
+
+void Y_xpa_servers(int argc)
+{
+    long dims[3];
+    const char* tmpl = NULL;
+    double ttl = 0.0;
+    char** out;
+    long index, i, j, n;
+    int iarg, npos = 0, col;
+
+    for (iarg = argc - 1; iarg >= 0; --iarg) {
+        index = yarg_key(iarg);
+        if (index == -1) {
+            if (++npos > 1) {
+                y_error("too many arguments");
+            }
+            if (! yarg_nil(iarg)) {
+                tmpl = ygets_q(iarg);
+            }
+        } else {
+            --iarg;
+            if (index_of_ttl < 0) {
+                initialize_indices();
+            }
+            if (index == index_of_ttl) {
+                if (! yarg_nil(iarg)) {
+                    ttl = ygets_d(iarg);
+                }
+            } else {
+                y_error("unknown keyword");
+            }
+        }
+    }
+
+    /* Refresh the list if too old. */
+    if (server_time < 0.0 || ttl <= 0.0 ||
+        stats_clock() - server_time > ttl) {
+        update_server_list();
+    }
+
+    /* Select matching access points. */
+    n = 0;
+    for (i = 0; i < server_count; ++i) {
+        if (tmpl == NULL ||
+            match_server(tmpl, server_list[SERVER_COLUMNS*i],
+                         server_list[SERVER_COLUMNS*i + 1])) {
+            ++n;
+        }
+    }
+    if (n < 1) {
+        ypush_nil();
+        return;
+    }
+    dims[0] = 2;
+    dims[1] = SERVER_COLUMNS;
+    dims[2] = n;
+    out = ypush_q(dims);
+    j = 0;
+    for (i = 0; i < server_count; ++i) {
+        char** row = &server_list[SERVER_COLUMNS*i];
+        if (tmpl == NULL || match_server(tmpl, row[0], row[1])) {
+            for (col = 0; col < SERVER_COLUMNS; ++col) {
+                out[SERVER_COLUMNS*j + col] = p_strcpy(row[col]);
+            }
+            ++j;
+        }
+    }
+}
+
+/*---------------------------------------------------------------------------*/
+/* SENDING IMAGES */
+
+/* Yields the FITS BITPIX value corresponding to a Yorick type (0 if not
+   supported). */
+static int get_bitpix(int typeid)
+{
+    switch (typeid) {
+    case Y_CHAR: return 8;
+    case Y_SHORT: return 8*sizeof(short);
+    case Y_INT: return 8*sizeof(int);
+    case Y_LONG: return 8*sizeof(long);
+    case Y_FLOAT: return -8*(int)sizeof(float);
+    case Y_DOUBLE: return -8*(int)sizeof(double);
+    default: return 0;
+    }
+}
+
+typedef struct fits_writer {
+    int         fd;      /* file descriptor to write to */
+    const char* hdr;     /* header */
+    size_t      hdrlen;  /* header size */
+    const char* data;    /* data (native byte order) */
+    size_t      len;     /* size of data */
+    size_t      elsize;  /* size of data elements */
+    int         swap;    /* swap bytes? */
+    int         status;  /* 0 on success, error number otherwise */
+} fits_writer_t;
+
+static int write_all(int fd, const void* buf, size_t len)
+{
+    const char* ptr = (const char*)buf;
+    while (len > 0) {
+        ssize_t nw = write(fd, ptr, len);
+        if (nw < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return errno;
+        }
+        ptr += nw;
+        len -= nw;
+    }
+    return 0;
+}
+
+/* Thread function writing a FITS file (header, data in big endian byte
+   order and padding) in a pipe.  Byte swapping is done by chunks so that no
+   copy of the whole data is needed. */
+static void* fits_writer(void* arg)
+{
+    fits_writer_t* w = (fits_writer_t*)arg;
+    char buf[65536];
+    size_t i, j, k, n, pad;
+
+    w->status = write_all(w->fd, w->hdr, w->hdrlen);
+    if (w->status == 0 && ! w->swap) {
+        w->status = write_all(w->fd, w->data, w->len);
+    } else if (w->status == 0) {
+        size_t chunk = (sizeof(buf)/w->elsize)*w->elsize;
+        for (i = 0; i < w->len && w->status == 0; i += n) {
+            const char* src = w->data + i;
+            n = (w->len - i < chunk ? w->len - i : chunk);
+            for (j = 0; j < n; j += w->elsize) {
+                for (k = 0; k < w->elsize; ++k) {
+                    buf[j + k] = src[j + w->elsize - 1 - k];
+                }
+            }
+            w->status = write_all(w->fd, buf, n);
+        }
+    }
+    pad = ROUND_UP(w->len, FITS_BLOCK) - w->len;
+    if (w->status == 0 && pad > 0) {
+        memset(buf, 0, pad);
+        w->status = write_all(w->fd, buf, pad);
+    }
+    close(w->fd);
+    return NULL;
+}
+
+/* Sends the FITS file described by `w` (all members but `fd` must be set)
+   by XPASetFd, the file being written in a pipe by another thread, and
+   yields the number of replies stored in `r` (-1 if the pipe or the thread
+   cannot be created).  On return, `w->status` is the status of the
+   writer. */
+static int send_fits(XPA xpa, char* apt, char* cmd, char* mode, int nmax,
+                     fits_writer_t* w, replies_t* r)
+{
+    pthread_t thread;
+    int fds[2], n;
+
+    if (pipe(fds) != 0) {
+        return -1;
+    }
+    w->fd = fds[1];
+    w->status = 0;
+    if (pthread_create(&thread, NULL, fits_writer, w) != 0) {
+        close(fds[0]);
+        close(fds[1]);
+        return -1;
+    }
+    n = XPASetFd(xpa, apt, cmd, mode, fds[0], r->srvs, r->msgs, nmax);
+    /* Drain the pipe in case XPASetFd did not read everything so that the
+       writer cannot be blocked.  A scratch buffer is used as the writer may
+       still be reading the header. */
+    for (;;) {
+        char scratch[4096];
+        ssize_t nr = read(fds[0], scratch, sizeof(scratch));
+        if (nr == 0 || (nr < 0 && errno != EINTR)) {
+            break;
+        }
+    }
+    pthread_join(thread, NULL);
+    close(fds[0]);
+    return n;
+}
+
+static replies_t* send_fits_in_lane(params_t* p, fits_writer_t* w);
+
+/* Yields a copy of the FITS file described by `w` as sent by `fits_writer`
+   (NULL if there is not enough memory).  Only needed to capture the call. */
+static char* fits_copy(const fits_writer_t* w, size_t* size)
+{
+    size_t i, k, len = w->hdrlen + ROUND_UP(w->len, FITS_BLOCK);
+    char* buf = malloc(len);
+    char* dst;
+    if (buf == NULL) {
+        return NULL;
+    }
+    memcpy(buf, w->hdr, w->hdrlen);
+    dst = buf + w->hdrlen;
+    if (! w->swap) {
+        memcpy(dst, w->data, w->len);
+    } else {
+        for (i = 0; i < w->len; i += w->elsize) {
+            for (k = 0; k < w->elsize; ++k) {
+                dst[i + k] = w->data[i + w->elsize - 1 - k];
+            }
+        }
+    }
+    memset(dst + w->len, 0, len - w->hdrlen - w->len);
+    *size = len;
+    return buf;
+}
+
+/* Formats a FITS header card in `dst`. */
+static void fits_card(char* dst, const char* key, const char* val)
+{
+    char card[FITS_CARD + 1];
+    int n = snprintf(card, sizeof(card), "%-8.8s= %20s", key, val);
+    memset(dst, ' ', FITS_CARD);
+    memcpy(dst, card, (n < FITS_CARD ? n : FITS_CARD));
+}
+
+void Y_xpa_set_image(int argc)
+{
+    long dims[Y_DIMSIZE];
+    char cmd[200];
+    char hdr[FITS_BLOCK];
+    char key[16], val[32];
+    XPA xpa;
+    replies_t* r;
+    params_t p;
+    double t0;
+    int typeid, bitpix, k, n;
+
+    /* Parse arguments and check the image. */
+    STATS_MARK(PHASE_PARSE);
+    parse_params(argc, PARSE_IMAGE, &p);
+    if (p.data < 0) {
+        y_error("expecting an image");
+    }
+    ygeta_any(p.data, NULL, dims, &typeid);
+    bitpix = get_bitpix(typeid);
+    if (bitpix == 0) {
+        y_error("unsupported image type");
+    }
+    if (dims[0] < 1 || dims[0] > (p.fits ? 999 : 3)) {
+        y_error("unsupported number of dimensions");
+    }
+
+    if (! p.fits) {
+        /* Send an "array" command with the image data in native byte
+           order (no copy is needed). */
+        n = snprintf(cmd, sizeof(cmd), "%s [xdim=%ld,ydim=%ld,",
+                     (p.cmd == NULL ? "array" : p.cmd), dims[1],
+                     (dims[0] >= 2 ? dims[2] : 1L));
+        if (dims[0] >= 3 && n < (int)sizeof(cmd)) {
+            n += snprintf(cmd + n, sizeof(cmd) - n, "zdim=%ld,", dims[3]);
+        }
+        if (n < (int)sizeof(cmd)) {
+            n += snprintf(cmd + n, sizeof(cmd) - n, "bitpix=%d,arch=%s]",
+                          bitpix, (little_endian() ? "littleendian" :
+                                   "bigendian"));
+        }
+        if (n >= (int)sizeof(cmd)) {
+            y_error("command too long");
+        }
+        p.cmd = cmd;
+        STATS_MARK(PHASE_CONNECT);
+        if (p.napts > 1 || p.lane != LANE_CONTROL) {
+            fanout(&p, 1);
+            if (timing) {
+                /* All phases of a fan-out are accounted as transfer. */
+                stats_times[PHASE_TRANSFER] = stats_times[PHASE_CONNECT];
+                STATS_MARK(PHASE_PUSH);
+                stats_times[PHASES] = stats_times[PHASE_PUSH];
+                record_call(&p, 1);
+            }
+            return;
+        }
+        resolve_nmax(&p, 1);
+        xpa = get_handle(&p);
+        r = get_shared_replies(p.nmax);
+        STATS_MARK(PHASE_TRANSFER);
+        t0 = latency_start();
+        n = XPASet(xpa, p.apt, p.cmd, MODE(&p), p.buf, p.len,
+                   r->srvs, r->msgs, p.nmax);
+        latency_record(p.apt, t0);
+    } else {
+        /* Send a FITS file whose header, data and padding are written in a
+           pipe by another thread. */
+        fits_writer_t w;
+        size_t len;
+
+        if (p.napts != 1) {
+            y_error("expecting a single access point");
+        }
+        if (dims[0] > (FITS_BLOCK/FITS_CARD) - 4) {
+            y_error("too many dimensions");
+        }
+        memset(hdr, ' ', sizeof(hdr));
+        len = 0;
+        fits_card(hdr + len, "SIMPLE", "T");
+        len += FITS_CARD;
+        sprintf(val, "%d", bitpix);
+        fits_card(hdr + len, "BITPIX", val);
+        len += FITS_CARD;
+        sprintf(val, "%ld", dims[0]);
+        fits_card(hdr + len, "NAXIS", val);
+        len += FITS_CARD;
+        for (k = 1; k <= dims[0]; ++k) {
+            sprintf(key, "NAXIS%d", k);
+            sprintf(val, "%ld", dims[k]);
+            fits_card(hdr + len, key, val);
+            len += FITS_CARD;
+        }
+        memcpy(hdr + len, "END", 3);
+
+        if (p.cmd == NULL) {
+            p.cmd = "fits";
+        }
+        w.hdr = hdr;
+        w.hdrlen = sizeof(hdr);
+        w.data = p.buf;
+        w.len = p.len;
+        w.elsize = elem_size(typeid);
+        w.swap = (w.elsize > 1 && little_endian());
+        STATS_MARK(PHASE_CONNECT);
+        if (p.lane != LANE_CONTROL) {
+            r = send_fits_in_lane(&p, &w);
+            STATS_MARK(PHASE_TRANSFER);
+        } else {
+            resolve_nmax(&p, 1);
+            xpa = get_handle(&p);
+            r = get_shared_replies(p.nmax);
+            STATS_MARK(PHASE_TRANSFER);
+            t0 = latency_start();
+            n = send_fits(xpa, p.apt, p.cmd, MODE(&p), p.nmax, &w, r);
+            latency_record(p.apt, t0);
+            if (n < 0) {
+                y_error("failed to start FITS writer");
+            }
+            if (w.status != 0) {
+                r->count = n;
+                y_errorq("failed to write FITS data (%s)", strerror(w.status));
+            }
+            r->count = (n > 0 ? n : 0);
+        }
+        STATS_MARK(PHASE_PUSH);
+        push_xpadata(r);
+        if (timing) {
+            /* The call is accounted with the FITS file actually sent. */
+            char* buf = NULL;
+            STATS_MARK(PHASES);
+            p.len = w.hdrlen + ROUND_UP(w.len, FITS_BLOCK);
+            if (capture_file != NULL &&
+                (buf = fits_copy(&w, &p.len)) == NULL) {
+                y_error("insufficient memory");
+            }
+            p.buf = buf;
+            record_call(&p, 1);
+            free(buf);
+        }
+        return;
+    }
+    r->count = (n > 0 ? n : 0);
+    STATS_MARK(PHASE_PUSH);
+    push_xpadata(r);
+    if (timing) {
+        STATS_MARK(PHASES);
+        record_call(&p, 1);
+    }
+}
+
+/*---------------------------------------------------------------------------*/
+/* TRANSFER PROCESSES */
+
+/* The XPA client library is not thread-safe, it is therefore only called by
+   the main thread.  The XPA commands which must not block the interpreter
+   (asynchronous requests and queued commands) or which are run concurrently
+   (fan-outs and the bulk lane) are executed by transfer processes: worker
+   processes forked by the main thread when needed and kept for the next
+   commands.  Each transfer process has its own persistent XPA handle, so
+   its connections to the name server and to the servers are reused from
+   one command to the next, and runs the commands it receives on a socket
+   one at a time, writing the replies back on the same socket.  The sockets
+   are read by the main thread when it waits for a job and, otherwise, by
+   the event loop of Yorick so that jobs progress while the interpreter is
+   idle.  The data to send are written on the socket when the job starts,
+   files (destinations of received data or files to send) are passed as
+   file descriptors.  A transfer process whose job is abandoned (timeout or
+   interruption) is killed, a new one is forked when needed. */
+
+#define POOL_MAX 32 /* maximum number of transfer processes per lane */
+#define BULK_MAX  2 /* default maximum number of bulk transfer processes */
+#define PASS_MAX 64 /* maximum number of files passed with a command */
+
+/* The event loop of Yorick calls `on_input(context)` when there is input
+   on `fd` (or when it has been closed), `on_input = NULL` unregisters `fd`.
+   This function is declared in "playu.h" which is not installed. */
+PLUG_API void u_event_src(int fd, void (*on_input)(void*), void* context);
+
+/* Writing on the socket of a transfer process which has died must not
+   raise SIGPIPE. */
+#ifdef MSG_NOSIGNAL
+#  define SEND_FLAGS MSG_NOSIGNAL
+#else
+#  define SEND_FLAGS 0
+#endif
+
+typedef enum {
+    JOB_NEW = 0,
+    JOB_PENDING,
+    JOB_RUNNING,
+    JOB_DONE
+} job_state_t;
+
+/* Kinds of XPA commands run by transfer processes. */
+#define JOB_GET   0 /* XPAGet */
+#define JOB_SET   1 /* XPASet of the data of the job */
+#define JOB_FILE  2 /* XPASet of a part of a passed file */
+#define JOB_FITS  3 /* XPASetFd of a FITS file written on the fly */
+#define JOB_GETFD 4 /* XPAGetFd to passed files */
+#define JOB_ACCESS 5 /* XPAAccess to the servers matching the access point */
+
+/* A command is sent to a transfer process as a request followed by the
+   access point, the command and the mode (with their final null) and the
+   data.  Values are in the native byte order. */
+typedef struct job_request {
+    int32_t  kind;     /* kind of command */
+    int32_t  nmax;     /* maximum number of recipients (-1 for all) */
+    uint32_t aptlen;   /* size of access point */
+    uint32_t cmdlen;   /* size of command (0 if none) */
+    uint32_t modelen;  /* size of mode string */
+    int32_t  nfds;     /* number of passed files */
+    uint64_t len;      /* size of data */
+    uint64_t size;     /* number of bytes to send (JOB_FILE) */
+    int64_t  offset;   /* offset of bytes to send (JOB_FILE) */
+    uint32_t hdrlen;   /* size of FITS header at start of data (JOB_FITS) */
+    uint16_t elsize;   /* size of image elements (JOB_FITS) */
+    uint16_t swap;     /* swap bytes of image? (JOB_FITS) */
+    int32_t  set;      /* access type of the command is "s"? */
+    int32_t  unused;
+} job_request_t;
+
+/* A transfer process writes a summary followed by the replies, each one as
+   a header followed by the server name and the message (with their final
+   null) and the data. */
+typedef struct job_summary {
+    double   duration; /* duration of the XPA command (s) */
+    int32_t  count;    /* number of replies */
+    int32_t  nmax;     /* number of addressed servers */
+} job_summary_t;
+
+typedef struct reply_header {
+    uint64_t len;      /* size of data (or number of bytes written to a
+                          passed file) */
+    uint32_t srvlen;   /* size of server name (0 if none) */
+    uint32_t msglen;   /* size of message (0 if none) */
+    int32_t  hasbuf;   /* reply has data? */
+    int32_t  unused;
+} reply_header_t;
+
+/* Fields read from the socket of a transfer process. */
+#define FIELD_SUMMARY 0
+#define FIELD_HEADER  1
+#define FIELD_SERVER  2
+#define FIELD_MESSAGE 3
+#define FIELD_DATA    4
+
+typedef struct job job_t;
+
+typedef struct worker worker_t;
+struct worker {
+    worker_t* next;   /* next transfer process of the pool */
+    pid_t     pid;    /* process identifier */
+    int       fd;     /* socket connected to the process */
+    job_t*    job;    /* job being run (NULL if idle) */
+    char*     apt;    /* access point of the last job (or NULL) */
+};
+
+struct job {
+    job_t*  next;     /* next job in queue or in list of running jobs */
+    struct pool* pool; /* pool running the job */
+    char*   apt;      /* access point (private copy) */
+    char*   cmd;      /* command (private copy or NULL) */
+    int     kind;     /* kind of command (JOB_GET, etc.) */
+    int     set;      /* XPA set command? */
+    char*   buf;      /* data to send */
+    size_t  len;      /* number of bytes to send */
+    void*   use;      /* Yorick use of the data to send (or NULL) */
+    int     owner;    /* job owns `buf`? */
+    char*   hdr;      /* FITS header (JOB_FITS, owned by the job) */
+    size_t  hdrlen;   /* size of `hdr` */
+    int     elsize;   /* size of image elements (JOB_FITS) */
+    int     swap;     /* swap bytes of image? (JOB_FITS) */
+    int*    fds;      /* files to pass (not owned by the job) */
+    int     nfds;     /* number of files to pass */
+    int     file;     /* file to send (JOB_FILE, owned by the job) */
+    off_t   offset;   /* offset of bytes to send in `file` */
+    char*   dest;     /* destination of received data (or NULL) */
+    size_t  destlen;  /* size of `dest` */
+    int     filled;   /* data have been received into `dest`? */
+    char*   out;      /* where the data of the reply being read go */
+    int     nmax;     /* maximum number of recipients */
+    char    mode[MODE_SIZE]; /* XPA mode string */
+    void  (*done)(job_t*); /* called when the job is done (or NULL) */
+    void*   data;     /* client data of the `done` callback */
+    int     cancel;   /* kill rather than orphan the job if released? */
+    worker_t* worker; /* transfer process running the job (or NULL) */
+    int     fd;       /* socket of the transfer process (-1 if none) */
+    struct pool* home; /* pool of the connection of the job (or NULL) */
+    int     field;    /* field being read from the socket */
+    int     index;    /* index of the reply being read */
+    size_t  got;      /* number of bytes of the field read so far */
+    job_summary_t  summary; /* summary sent by the transfer process */
+    reply_header_t header;  /* header of the reply being read */
+    job_state_t state;
+    replies_t rep;    /* replies */
+};
+
+typedef struct pool {
+    job_t*    first;     /* first queued job */
+    job_t*    last;      /* last queued job */
+    job_t*    active;    /* list of running jobs */
+    worker_t* procs;     /* transfer processes (running or idle) */
+    int       running;   /* number of running jobs */
+    int       max;       /* maximum number of transfer processes */
+    int       nprocs;    /* number of transfer processes */
+    long      pending;   /* number of queued jobs */
+    long      completed; /* number of completed jobs */
+    char*     method;    /* XPA_METHOD of the transfer processes (or NULL) */
+    int       refs;      /* number of references (pool of a connection) */
+} pool_t;
+
+/* Pool for the control lane (also used by default). */
+static pool_t workers = {NULL, NULL, NULL, NULL, 0, POOL_MAX, 0, 0, 0,
+                         NULL, 0};
+
+/* Pool for the bulk lane. */
+static pool_t bulk_workers = {NULL, NULL, NULL, NULL, 0, BULK_MAX, 0, 0, 0,
+                              NULL, 0};
+
+#define LANE_POOL(lane) ((lane) == LANE_BULK ? &bulk_workers : &workers)
+
+/* Yields the pool of transfer processes running the commands of `p`. */
+static pool_t* lane_pool(const params_t* p)
+{
+    return (p->lane == LANE_CONN ? p->conn->pool : LANE_POOL(p->lane));
+}
+
+/* Orphaned jobs (running jobs which have been released) are moved, with
+   their transfer process, to this pool so that they do not hold the slots
+   of their lane.  At most ORPHAN_MAX orphans are left to complete, others
+   are killed.  The transfer process of an orphan exits with its job. */
+#define ORPHAN_MAX 32
+static pool_t orphans = {NULL, NULL, NULL, NULL, 0, ORPHAN_MAX, 0, 0, 0,
+                         NULL, 0};
+
+static void start_jobs(pool_t* pool);
+
+/* Reads exactly `len` bytes from the blocking file `fd`.  Yields 0 on
+   success, -1 at the end of the file or on error. */
+static int read_all(int fd, void* buf, size_t len)
+{
+    char* ptr = (char*)buf;
+    while (len > 0) {
+        ssize_t nr = read(fd, ptr, len);
+        if (nr <= 0) {
+            if (nr < 0 && errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        ptr += nr;
+        len -= nr;
+    }
+    return 0;
+}
+
+/* Maps `len` bytes of the file `fd` at `offset` in memory.  Yields the
+   address of the mapping (NULL if `len` is zero, MAP_FAILED on failure) of
+   size `*maplen`, the bytes start at `offset % pagesize`. */
+static char* map_file(int fd, off_t offset, size_t len, size_t* maplen)
+{
+    long pagesize = sysconf(_SC_PAGESIZE);
+    off_t base = (offset/pagesize)*pagesize;
+    char* map;
+
+    *maplen = 0;
+    if (len == 0) {
+        return NULL;
+    }
+    *maplen = len + (offset - base);
+    map = mmap(NULL, *maplen, PROT_READ, MAP_SHARED, fd, base);
+#ifdef MADV_SEQUENTIAL
+    if (map != MAP_FAILED) {
+        madvise(map, *maplen, MADV_SEQUENTIAL);
+    }
+#endif
+    return map;
+}
+
+/* Writes a reply on the socket of a transfer process.  Yields 0 on success,
+   an error number otherwise. */
+static int send_reply(int fd, const char* srv, const char* msg,
+                      const char* buf, size_t len)
+{
+    reply_header_t hdr;
+    int status;
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.len = len;
+    hdr.srvlen = (srv == NULL ? 0 : strlen(srv) + 1);
+    hdr.msglen = (msg == NULL ? 0 : strlen(msg) + 1);
+    hdr.hasbuf = (buf != NULL);
+    status = write_all(fd, &hdr, sizeof(hdr));
+    if (status == 0) {
+        status = write_all(fd, srv, hdr.srvlen);
+    }
+    if (status == 0) {
+        status = write_all(fd, msg, hdr.msglen);
+    }
+    if (status == 0 && buf != NULL) {
+        status = write_all(fd, buf, len);
+    }
+    return status;
+}
+
+/* Reads a request on the socket `fd` of a transfer process, the passed
+   files are stored in `fds`.  Yields the number of passed files, -1 if the
+   socket has been closed or on error. */
+static int recv_request(int fd, job_request_t* req, int* fds)
+{
+    union {
+        struct cmsghdr hdr;
+        char buf[CMSG_SPACE(PASS_MAX*sizeof(int))];
+    } ctl;
+    struct msghdr msg;
+    struct iovec iov;
+    struct cmsghdr* cmsg;
+    ssize_t nr;
+    int k, n = 0;
+
+    memset(&msg, 0, sizeof(msg));
+    iov.iov_base = req;
+    iov.iov_len = sizeof(*req);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = ctl.buf;
+    msg.msg_controllen = sizeof(ctl.buf);
+    do {
+        nr = recvmsg(fd, &msg, 0);
+    } while (nr < 0 && errno == EINTR);
+    if (nr <= 0) {
+        return -1;
+    }
+    for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL;
+         cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if (cmsg->cmsg_level == SOL_SOCKET &&
+            cmsg->cmsg_type == SCM_RIGHTS) {
+            k = (cmsg->cmsg_len - CMSG_LEN(0))/sizeof(int);
+            if (n + k > PASS_MAX) {
+                return -1;
+            }
+            memcpy(fds + n, CMSG_DATA(cmsg), k*sizeof(int));
+            n += k;
+        }
+    }
+    if ((size_t)nr < sizeof(*req) &&
+        read_all(fd, (char*)req + nr, sizeof(*req) - nr) != 0) {
+        return -1;
+    }
+    return n;
+}
+
+static int get_to_fds(XPA xpa, char* apt, char* cmd, char* mode,
+                      const int* fds, int n, replies_t* r);
+
+/* Runs, in a transfer process, the XPA command of a request with the XPA
+   handle `xpa` and yields the number of replies stored in `r`.  On error,
+   -1 is returned and `*err` is set. */
+static int run_request(XPA xpa, const job_request_t* req, char* apt,
+                       char* cmd, char* mode, char* data, int* fds,
+                       int nfds, int nmax, replies_t* r, const char** err)
+{
+    fits_writer_t w;
+    size_t maplen;
+    char* map;
+    int n;
+
+    switch (req->kind) {
+    case JOB_GET:
+        return XPAGet(xpa, apt, cmd, mode, r->bufs, r->lens,
+                      r->srvs, r->msgs, nmax);
+    case JOB_SET:
+        return XPASet(xpa, apt, cmd, mode, data, req->len,
+                      r->srvs, r->msgs, nmax);
+    case JOB_FILE:
+        if (nfds != 1) {
+            break;
+        }
+        map = map_file(fds[0], req->offset, req->size, &maplen);
+        if (map == MAP_FAILED) {
+            *err = "failed to map file in memory";
+            return -1;
+        }
+        n = XPASet(xpa, apt, cmd, mode,
+                   (map == NULL ? NULL : map + (maplen - req->size)),
+                   req->size, r->srvs, r->msgs, nmax);
+        if (map != NULL) {
+            munmap(map, maplen);
+        }
+        return n;
+    case JOB_FITS:
+        if (req->hdrlen > req->len || req->elsize < 1) {
+            break;
+        }
+        w.hdr = data;
+        w.hdrlen = req->hdrlen;
+        w.data = data + req->hdrlen;
+        w.len = req->len - req->hdrlen;
+        w.elsize = req->elsize;
+        w.swap = req->swap;
+        n = send_fits(xpa, apt, cmd, mode, nmax, &w, r);
+        if (n < 0 || w.status != 0) {
+            r->count = (n > 0 ? n : 0);
+            clear_replies(r);
+            *err = (n < 0 ? "failed to start FITS writer" :
+                    "failed to write FITS data");
+            return -1;
+        }
+        return n;
+    case JOB_GETFD:
+        if (nfds < 1) {
+            break;
+        }
+        n = get_to_fds(xpa, apt, cmd, mode, fds, nfds, r);
+        if (n < 0) {
+            *err = "failed to start data copy";
+        }
+        return n;
+    case JOB_ACCESS:
+        if (nmax < 1) {
+            return 0;
+        }
+        return XPAAccess(xpa, apt, (req->set ? "s" : "g"), mode,
+                         r->srvs, r->msgs, nmax);
+    }
+    *err = "invalid request";
+    return -1;
+}
+
+/* Main loop of a transfer process: runs the commands received on the
+   socket `fd` with a persistent XPA handle and writes back the replies,
+   until the socket is closed by Yorick. */
+static void run_worker(int fd)
+{
+    char mode[MODE_SIZE + 12];
+    char msg[100];
+    replies_t rep = {NULL, NULL, NULL, NULL, 0, 0};
+    replies_t* r = &rep;
+    job_request_t req;
+    job_summary_t sum;
+    const char* err;
+    char* strs;
+    char* data;
+    char* apt;
+    char* cmd;
+    XPA xpa;
+    double t0;
+    size_t size;
+    int fds[PASS_MAX];
+    int i, n, nfds, nmax, status;
+
+    /* Interrupts are handled by Yorick. */
+    signal(SIGINT, SIG_IGN);
+    xpa = XPAOpen(NULL);
+    for (;;) {
+        nfds = recv_request(fd, &req, fds);
+        if (nfds < 0) {
+            break;
+        }
+        size = (size_t)req.aptlen + req.cmdlen + req.modelen;
+        strs = malloc(size);
+        if (strs == NULL || req.aptlen < 1 || req.modelen < 1 ||
+            req.modelen > MODE_SIZE || read_all(fd, strs, size) != 0) {
+            break;
+        }
+        apt = strs;
+        cmd = (req.cmdlen > 0 ? strs + req.aptlen : NULL);
+        noxpa_mode(mode, strs + req.aptlen + req.cmdlen);
+        err = NULL;
+        data = NULL;
+        if (req.len > 0) {
+            /* Data which cannot be stored are consumed anyway. */
+            data = malloc(req.len);
+            if (data != NULL) {
+                status = read_all(fd, data, req.len);
+            } else {
+                char scratch[4096];
+                uint64_t k, len;
+                err = "insufficient memory";
+                for (status = 0, k = 0; k < req.len && status == 0;
+                     k += len) {
+                    len = req.len - k;
+                    if (len > sizeof(scratch)) {
+                        len = sizeof(scratch);
+                    }
+                    status = read_all(fd, scratch, len);
+                }
+            }
+            if (status != 0) {
+                break;
+            }
+        }
+        t0 = stats_clock();
+        nmax = req.nmax;
+        if (req.kind == JOB_ACCESS) {
+            /* Check the servers known by the name server. */
+            n = count_servers(xpa, apt, (req.set ? "s" : "g"));
+            nmax = (nmax > 0 && n > nmax ? nmax : n);
+        } else if (nmax < 0) {
+            /* The name server is queried here so that the lookup is bounded
+               by the timeout of the command. */
+            n = count_servers(xpa, apt, (req.set ? "s" : "g"));
+            nmax = (n > 1 ? n : 1);
+        }
+        n = -1;
+        if (err == NULL && reserve_replies(r, nmax) != 0) {
+            err = "insufficient memory";
+        }
+        if (err == NULL) {
+            n = run_request(xpa, &req, apt, cmd, mode, data, fds, nfds,
+                            nmax, r, &err);
+        }
+        memset(&sum, 0, sizeof(sum));
+        sum.duration = stats_clock() - t0;
+        sum.count = (n < 0 ? 1 : n);
+        sum.nmax = nmax;
+        status = write_all(fd, &sum, sizeof(sum));
+        if (n < 0 && status == 0) {
+            snprintf(msg, sizeof(msg), "XPA$ERROR %s\n",
+                     (err == NULL ? "XPA command failed" : err));
+            status = send_reply(fd, apt, msg, NULL, 0);
+        }
+        for (i = 0; i < n && status == 0; ++i) {
+            status = send_reply(fd, r->srvs[i], r->msgs[i], r->bufs[i],
+                                r->lens[i]);
+        }
+        r->count = (n > 0 ? n : 0);
+        clear_replies(r);
+        for (i = 0; i < nfds; ++i) {
+            close(fds[i]);
+        }
+        free(data);
+        free(strs);
+        if (status != 0) {
+            break;
+        }
+    }
+    _exit(0);
+}
+
+/* Closes, in a new transfer process, all the files inherited from Yorick
+   but the standard ones and `keep`.  In particular, the sockets of the
+   other transfer processes must not be kept open, otherwise these would not
+   notice that Yorick has closed them. */
+static void close_inherited(int keep)
+{
+    long fd, max = sysconf(_SC_OPEN_MAX);
+    if (max < 0 || max > 65536) {
+        max = 65536;
+    }
+    for (fd = 3; fd < max; ++fd) {
+        if (fd != keep) {
+            close(fd);
+        }
+    }
+}
+
+/* Forks a new transfer process for a pool.  Yields NULL on failure. */
+static worker_t* spawn_worker(pool_t* pool)
+{
+    worker_t* w;
+    pid_t pid;
+    int sv[2];
+
+    w = (worker_t*)malloc(sizeof(worker_t));
+    if (w == NULL) {
+        return NULL;
+    }
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) != 0) {
+        free(w);
+        return NULL;
+    }
+    pid = fork();
+    if (pid == 0) {
+        close_inherited(sv[1]);
+        if (pool->method != NULL) {
+            setenv("XPA_METHOD", pool->method, 1);
+        }
+        run_worker(sv[1]);
+    }
+    close(sv[1]);
+    if (pid < 0) {
+        close(sv[0]);
+        free(w);
+        return NULL;
+    }
+    fcntl(sv[0], F_SETFL, fcntl(sv[0], F_GETFL) | O_NONBLOCK);
+    fcntl(sv[0], F_SETFD, FD_CLOEXEC);
+#ifdef SO_NOSIGPIPE
+    {
+        int on = 1;
+        setsockopt(sv[0], SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+    }
+#endif
+    w->pid = pid;
+    w->fd = sv[0];
+    w->job = NULL;
+    w->apt = NULL;
+    w->next = pool->procs;
+    pool->procs = w;
+    ++pool->nprocs;
+    return w;
+}
+
+/* Removes a transfer process from the list of a pool. */
+static void unlink_worker(pool_t* pool, worker_t* w)
+{
+    worker_t** prev;
+    for (prev = &pool->procs; *prev != NULL; prev = &(*prev)->next) {
+        if (*prev == w) {
+            *prev = w->next;
+            --pool->nprocs;
+            break;
+        }
+    }
+    w->next = NULL;
+}
+
+/* Terminates a transfer process of a pool, it is killed as it may be in
+   the middle of a command. */
+static void retire_worker(pool_t* pool, worker_t* w)
+{
+    int status;
+    unlink_worker(pool, w);
+    close(w->fd);
+    kill(w->pid, SIGKILL);
+    while (waitpid(w->pid, &status, 0) < 0 && errno == EINTR)
+        ;
+    free(w->apt);
+    free(w);
+}
+
+/* Terminates the idle transfer processes of a pool in excess of its
+   maximum. */
+static void trim_workers(pool_t* pool)
+{
+    worker_t* w = pool->procs;
+    while (w != NULL && pool->nprocs > pool->max) {
+        worker_t* next = w->next;
+        if (w->job == NULL) {
+            retire_worker(pool, w);
+        }
+        w = next;
+    }
+}
+
+/* Yields a transfer process of a pool to run a job for the access point
+   `apt`.  The connections of a transfer process are kept, so an idle
+   process which has last served the same access point is preferred, then a
+   new process as long as the pool is not full, then any idle process.
+   Yields NULL on failure. */
+static worker_t* get_worker(pool_t* pool, const char* apt)
+{
+    worker_t* w;
+    worker_t* idle = NULL;
+    for (w = pool->procs; w != NULL; w = w->next) {
+        if (w->job == NULL) {
+            if (w->apt != NULL && strcmp(w->apt, apt) == 0) {
+                return w;
+            }
+            idle = w;
+        }
+    }
+    if (idle == NULL || pool->nprocs < pool->max) {
+        w = spawn_worker(pool);
+        if (w != NULL) {
+            return w;
+        }
+    }
+    return idle;
+}
+
+/* Writes `len` bytes on the non-blocking socket `fd` of a transfer process.
+   Yields 0 on success, an error number otherwise. */
+static int send_all(int fd, const void* buf, size_t len)
+{
+    const char* ptr = (const char*)buf;
+    struct pollfd pfd;
+    while (len > 0) {
+        ssize_t nw = send(fd, ptr, len, SEND_FLAGS);
+        if (nw >= 0) {
+            ptr += nw;
+            len -= nw;
+        } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            pfd.fd = fd;
+            pfd.events = POLLOUT;
+            pfd.revents = 0;
+            poll(&pfd, 1, -1);
+        } else if (errno != EINTR) {
+            return errno;
+        }
+    }
+    return 0;
+}
+
+/* Sends the request of a job, with the files to pass, to the socket `fd`
+   of an idle transfer process.  Yields 0 on success, an error number
+   otherwise. */
+static int send_request(int fd, job_t* job)
+{
+    union {
+        struct cmsghdr hdr;
+        char buf[CMSG_SPACE(PASS_MAX*sizeof(int))];
+    } ctl;
+    struct msghdr msg;
+    struct iovec iov;
+    struct cmsghdr* cmsg;
+    job_request_t req;
+    ssize_t nw;
+    int status;
+
+    memset(&req, 0, sizeof(req));
+    req.kind = job->kind;
+    req.nmax = job->nmax;
+    req.aptlen = strlen(job->apt) + 1;
+    req.cmdlen = (job->cmd == NULL ? 0 : strlen(job->cmd) + 1);
+    req.modelen = strlen(job->mode) + 1;
+    req.nfds = job->nfds;
+    if (job->kind == JOB_FILE) {
+        req.size = job->len;
+        req.offset = job->offset;
+    } else {
+        req.len = job->hdrlen + (job->buf == NULL ? 0 : job->len);
+    }
+    req.hdrlen = job->hdrlen;
+    req.elsize = job->elsize;
+    req.swap = job->swap;
+    req.set = job->set;
+
+    memset(&msg, 0, sizeof(msg));
+    iov.iov_base = &req;
+    iov.iov_len = sizeof(req);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    if (job->nfds > 0) {
+        msg.msg_control = ctl.buf;
+        msg.msg_controllen = CMSG_SPACE(job->nfds*sizeof(int));
+        cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(job->nfds*sizeof(int));
+        memcpy(CMSG_DATA(cmsg), job->fds, job->nfds*sizeof(int));
+    }
+    /* The socket of an idle transfer process is empty, so the request can
+       be sent at once (at least its first byte with the files). */
+    do {
+        nw = sendmsg(fd, &msg, SEND_FLAGS);
+    } while (nw < 0 && errno == EINTR);
+    if (nw < 0) {
+        return errno;
+    }
+    status = send_all(fd, (char*)&req + nw, sizeof(req) - nw);
+    if (status == 0) {
+        status = send_all(fd, job->apt, req.aptlen);
+    }
+    if (status == 0) {
+        status = send_all(fd, job->cmd, req.cmdlen);
+    }
+    if (status == 0) {
+        status = send_all(fd, job->mode, req.modelen);
+    }
+    if (status == 0) {
+        status = send_all(fd, job->hdr, job->hdrlen);
+    }
+    if (status == 0 && job->kind != JOB_FILE && job->buf != NULL) {
+        status = send_all(fd, job->buf, job->len);
+    }
+    return status;
+}
+
+/* Releases the data of a job once sent (or when the job is freed). */
+static void release_data(job_t* job)
+{
+    if (job->use != NULL) {
+        ydrop_use(job->use);
+        job->use = NULL;
+    }
+    if (job->owner) {
+        free(job->buf);
+        job->owner = 0;
+    }
+    job->buf = NULL;
+    free(job->hdr);
+    job->hdr = NULL;
+    job->hdrlen = 0;
+    if (job->file >= 0) {
+        close(job->file);
+        job->file = -1;
+    }
+    job->fds = NULL;
+    job->nfds = 0;
+}
+
+/* Replaces the replies of a job by an error reply with message `err`. */
+static void fail_replies(job_t* job, const char* err)
+{
+    replies_t* r = &job->rep;
+    char msg[100];
+    clear_replies(r);
+    if (reserve_replies(r, 1) == 0) {
+        snprintf(msg, sizeof(msg), "XPA$ERROR %s\n", err);
+        r->lens[0] = 0;
+        r->bufs[0] = NULL;
+        r->srvs[0] = strdup(job->apt);
+        r->msgs[0] = strdup(msg);
+        r->count = 1;
+    }
+}
+
+/* Removes a running job from the list of running jobs of a pool. */
+static void remove_active(pool_t* pool, job_t* job)
+{
+    job_t** prev;
+    for (prev = &pool->active; *prev != NULL; prev = &(*prev)->next) {
+        if (*prev == job) {
+            *prev = job->next;
+            break;
+        }
+    }
+    job->next = NULL;
+    --pool->running;
+}
+
+/* Terminates a running job.  Its transfer process becomes idle, unless the
+   job is abandoned or failed (`err` not NULL), the process being then in
+   the middle of a command, or it is in excess in its pool: the process is
+   then terminated.  If `err` is not NULL, the replies are replaced by an
+   error reply with message `err`.  Queued jobs of the pool are started,
+   then the `done` callback of the job is called (it may free the job).
+   This never raises errors so that it can be called by the event loop. */
+static void finish_job(job_t* job, const char* err)
+{
+    pool_t* pool = job->pool;
+    worker_t* w = job->worker;
+
+    if (w != NULL) {
+        u_event_src(w->fd, NULL, NULL);
+        w->job = NULL;
+        job->worker = NULL;
+        job->fd = -1;
+        if (err != NULL || pool == &orphans || pool->nprocs > pool->max) {
+            retire_worker(pool, w);
+        }
+    }
+    remove_active(pool, job);
+    ++pool->completed;
+    if (err != NULL) {
+        fail_replies(job, err);
+    } else {
+        latency_add(job->apt, job->summary.duration);
+    }
+    job->state = JOB_DONE;
+    start_jobs(pool);
+    if (job->done != NULL) {
+        job->done(job);
+    }
+}
+
+/* Reads the current field from the socket of a job into `dst` of `size`
+   bytes.  Yields 1 if the field is complete, 0 if the socket has no more
+   data for now, -1 if the socket has been closed or on error. */
+static int read_socket(job_t* job, void* dst, size_t size)
+{
+    ssize_t nr;
+    while (job->got < size) {
+        nr = read(job->fd, (char*)dst + job->got, size - job->got);
+        if (nr > 0) {
+            job->got += nr;
+        } else if (nr == 0) {
+            return -1;
+        } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            return 0;
+        } else if (errno != EINTR) {
+            return -1;
+        }
+    }
+    job->got = 0;
+    return 1;
+}
+
+/* Reads the replies available on the socket of a running job.  The job is
+   finished when all the replies have been read or if the transfer process
+   failed.  This never raises errors so that it can be called by the event
+   loop. */
+static void pump_job(job_t* job)
+{
+    replies_t* r = &job->rep;
+    reply_header_t* hdr = &job->header;
+    int i, status = 1;
+
+    while (job->state == JOB_RUNNING && status > 0) {
+        i = job->index;
+        switch (job->field) {
+        case FIELD_SUMMARY:
+            status = read_socket(job, &job->summary, sizeof(job->summary));
+            if (status > 0) {
+                if (job->summary.count < 0 ||
+                    reserve_replies(r, job->summary.count) != 0) {
+                    finish_job(job, "insufficient memory");
+                    return;
+                }
+                job->field = FIELD_HEADER;
+            }
+            break;
+        case FIELD_HEADER:
+            status = read_socket(job, hdr, sizeof(reply_header_t));
+            if (status > 0) {
+                r->count = i + 1;
+                r->lens[i] = hdr->len;
+                job->out = NULL;
+                if (hdr->hasbuf && job->dest != NULL && ! job->filled &&
+                    hdr->len == job->destlen) {
+                    /* Data of the expected size are directly read into
+                       the destination. */
+                    job->filled = 1;
+                    job->out = job->dest;
+                } else if (hdr->hasbuf) {
+                    job->out = r->bufs[i] = malloc(hdr->len + 1);
+                }
+                if ((hdr->srvlen > 0 &&
+                     (r->srvs[i] = malloc(hdr->srvlen)) == NULL) ||
+                    (hdr->msglen > 0 &&
+                     (r->msgs[i] = malloc(hdr->msglen)) == NULL) ||
+                    (hdr->hasbuf && job->out == NULL)) {
+                    finish_job(job, "insufficient memory");
+                    return;
+                }
+                job->field = FIELD_SERVER;
+            }
+            break;
+        case FIELD_SERVER:
+            status = read_socket(job, r->srvs[i], hdr->srvlen);
+            if (status > 0) {
+                job->field = FIELD_MESSAGE;
+            }
+            break;
+        case FIELD_MESSAGE:
+            status = read_socket(job, r->msgs[i], hdr->msglen);
+            if (status > 0) {
+                job->field = FIELD_DATA;
+            }
+            break;
+        default:
+            status = read_socket(job, job->out,
+                                 (job->out == NULL ? 0 : hdr->len));
+            if (status > 0) {
+                job->index = i + 1;
+                job->field = FIELD_HEADER;
+            }
+        }
+        if (status > 0 && job->field == FIELD_HEADER &&
+            job->index >= job->summary.count) {
+            finish_job(job, NULL);
+            return;
+        }
+    }
+    if (status < 0) {
+        finish_job(job, "transfer process failed");
+    }
+}
+
+/* Callback of the event loop for the socket of a running job. */
+static void on_job_input(void* context)
+{
+    pump_job((job_t*)context);
+}
+
+/* Starts a job by an idle transfer process of its pool. */
+static void start_job(pool_t* pool, job_t* job)
+{
+    worker_t* w;
+    int status;
+
+    job->state = JOB_RUNNING;
+    job->next = pool->active;
+    pool->active = job;
+    ++pool->running;
+    job->field = FIELD_SUMMARY;
+    job->index = 0;
+    job->got = 0;
+    w = get_worker(pool, job->apt);
+    if (w == NULL) {
+        finish_job(job, "failed to start transfer process");
+        return;
+    }
+    if (w->apt == NULL || strcmp(w->apt, job->apt) != 0) {
+        free(w->apt);
+        w->apt = strdup(job->apt);
+    }
+    w->job = job;
+    job->worker = w;
+    job->fd = w->fd;
+    status = send_request(w->fd, job);
+    release_data(job);
+    if (status != 0) {
+        finish_job(job, "failed to send command to transfer process");
+        return;
+    }
+    u_event_src(job->fd, on_job_input, job);
+}
+
+/* Starts as many queued jobs of a pool as allowed. */
+static void start_jobs(pool_t* pool)
+{
+    job_t* job;
+    while (pool->running < pool->max && (job = pool->first) != NULL) {
+        pool->first = job->next;
+        if (pool->first == NULL) {
+            pool->last = NULL;
+        }
+        --pool->pending;
+        start_job(pool, job);
+    }
+}
+
+/* Queues a job for execution by a pool, it is started at once if the pool
+   is not full.  If it cannot be started, the job is done with an error
+   reply (and may have been freed by its `done` callback). */
+static void submit_job(pool_t* pool, job_t* job)
+{
+    job->pool = pool;
+    job->next = NULL;
+    job->state = JOB_PENDING;
+    if (pool->last == NULL) {
+        pool->first = job;
+    } else {
+        pool->last->next = job;
+    }
+    pool->last = job;
+    ++pool->pending;
+    start_jobs(pool);
+}
+
+/* Removes a queued job from the queue of its pool. */
+static void unqueue_job(job_t* job)
+{
+    pool_t* pool = job->pool;
+    job_t* prev = NULL;
+    job_t* next;
+    for (next = pool->first; next != job; next = next->next) {
+        prev = next;
+    }
+    if (prev == NULL) {
+        pool->first = job->next;
+    } else {
+        prev->next = job->next;
+    }
+    if (pool->last == job) {
+        pool->last = prev;
+    }
+    job->next = NULL;
+    --pool->pending;
+    job->state = JOB_NEW;
+}
+
+/* Waits at most `ms` milliseconds for output of the transfer processes of a
+   pool and reads it. */
+static void poll_pool(pool_t* pool, int ms)
+{
+    struct pollfd pfds[POOL_MAX];
+    job_t* jobs[POOL_MAX];
+    job_t* job;
+    int i, n = 0;
+
+    for (job = pool->active; job != NULL && n < POOL_MAX; job = job->next) {
+        pfds[n].fd = job->fd;
+        pfds[n].events = POLLIN;
+        pfds[n].revents = 0;
+        jobs[n++] = job;
+    }
+    if (n > 0 && poll(pfds, n, ms) > 0) {
+        for (i = 0; i < n; ++i) {
+            if (pfds[i].revents != 0) {
+                pump_job(jobs[i]);
+            }
+        }
+    }
+}
+
+/* Waits for a job to be done until the time `deadline` (as given by
+   `stats_clock`, a non-positive value meaning forever) and yields whether
+   the job is done.  The other jobs of the pool progress meanwhile.  Waiting
+   can be interrupted by the user. */
+static int wait_job(job_t* job, double deadline)
+{
+    double rem;
+    int ms;
+    while (job->state != JOB_DONE) {
+        ms = 100; /* check for interrupts every 0.1 s */
+        if (deadline > 0.0) {
+            rem = deadline - stats_clock();
+            if (rem <= 0.0) {
+                break;
+            }
+            if (rem < 0.1) {
+                ms = (int)ceil(1e3*rem);
+            }
+        }
+        poll_pool(job->pool, ms);
+        if (p_signalling && job->state != JOB_DONE) {
+            p_abort();
+        }
+    }
+    return (job->state == JOB_DONE);
+}
+
+/* Creates a new job for the XPA command whose arguments are given by `p`.
+   The data to send by a set command, if any, are copied if `copy` is true;
+   otherwise, a reference on the Yorick array is kept until the data have
+   been sent to the transfer process.  The caller may then change the kind
+   of the job. */
+static job_t* new_job(int set, params_t* p, int copy)
+{
+    job_t* job;
+
+    if (p->conn != NULL && p->conn->pool == NULL) {
+        y_error("keyword `conn` is not supported by commands run by "
+                "transfer processes");
+    }
+    job = (job_t*)malloc(sizeof(job_t));
+    if (job == NULL) {
+        y_error("insufficient memory");
+    }
+    memset(job, 0, sizeof(job_t));
+    job->fd = -1;
+    job->file = -1;
+    job->kind = (set ? JOB_SET : JOB_GET);
+    job->set = set;
+    job->nmax = p->nmax;
+    memcpy(job->mode, p->mode, MODE_SIZE);
+    job->apt = strdup(p->apt);
+    job->cmd = (p->cmd == NULL ? NULL : strdup(p->cmd));
+    if (job->apt == NULL || (p->cmd != NULL && job->cmd == NULL)) {
+        goto nomem;
+    }
+    if (p->conn != NULL) {
+        /* The pool of the connection lives as long as its jobs. */
+        job->home = p->conn->pool;
+        ++job->home->refs;
+    }
+    if (set && p->len > 0) {
+        job->len = p->len;
+        if (! copy && yarg_rank(p->data) > 0) {
+            /* Keep a reference on the array to send. */
+            job->buf = p->buf;
+            job->use = yget_use(p->data);
+        } else {
+            /* Scalars may live on the stack, make a copy. */
+            job->buf = malloc(p->len);
+            if (job->buf == NULL) {
+                goto nomem;
+            }
+            memcpy(job->buf, p->buf, p->len);
+            job->owner = 1;
+        }
+    }
+    return job;
+
+ nomem:
+    free(job->apt);
+    free(job->cmd);
+    free(job);
+    y_error("insufficient memory");
+    return NULL;
+}
+
+/* Frees resources associated with a job which must not be running. */
+static void free_job(job_t* job)
+{
+    free_replies(&job->rep);
+    release_data(job);
+    if (job->home != NULL) {
+        unref_pool(job->home);
+    }
+    free(job->apt);
+    free(job->cmd);
+    free(job);
+}
+
+/* Creates the pool of a connection with a method, its transfer process
+   sets XPA_METHOD before opening its XPA handle. */
+static pool_t* new_conn_pool(const char* method)
+{
+    pool_t* pool = (pool_t*)malloc(sizeof(pool_t));
+    if (pool != NULL) {
+        memset(pool, 0, sizeof(pool_t));
+        pool->max = 1;
+        pool->refs = 1;
+        pool->method = strdup(method);
+        if (pool->method == NULL) {
+            free(pool);
+            pool = NULL;
+        }
+    }
+    if (pool == NULL) {
+        y_error("insufficient memory");
+    }
+    return pool;
+}
+
+/* Drops a reference on the pool of a connection, the pool and its transfer
+   process are destroyed with the last reference (the pool has then no
+   jobs). */
+static void unref_pool(pool_t* pool)
+{
+    if (--pool->refs > 0) {
+        return;
+    }
+    while (pool->procs != NULL) {
+        retire_worker(pool, pool->procs);
+    }
+    free(pool->method);
+    free(pool);
+}
+
+/* Runs XPAAccess for `apt` (with access type "s" if `set` is true, "g"
+   otherwise) by the transfer process of the connection `obj` and waits for
+   it.  The replies are stored in `r` (which must have no replies).  Yields
+   the number of servers checked (at most `nmax` if positive).  Waiting is not interruptible, XPAAccess is bounded by the XPA
+   timeouts. */
+static int access_by_worker(xpaconn_t* obj, const char* apt, int set,
+                            int nmax, replies_t* r)
+{
+    replies_t tmp;
+    params_t p;
+    job_t* job;
+    int count;
+
+    memset(&p, 0, sizeof(p));
+    p.apt = (char*)apt;
+    p.data = -1;
+    p.nmax = nmax;
+    p.conn = obj;
+    job = new_job(0, &p, 0);
+    job->kind = JOB_ACCESS;
+    job->set = set;
+    submit_job(obj->pool, job);
+    while (job->state != JOB_DONE) {
+        poll_pool(job->pool, 100);
+    }
+    count = job->summary.nmax; /* 0 if the transfer process failed */
+    tmp = *r;
+    *r = job->rep;
+    job->rep = tmp;
+    free_job(job);
+    return count;
+}
+
+/* Gives up a job which is not done: a queued job is cancelled, the
+   transfer process of a running job is killed.  The job is then done with
+   an error reply with message `err`. */
+static void cancel_job(job_t* job, const char* err)
+{
+    job->done = NULL;
+    if (job->state == JOB_PENDING) {
+        unqueue_job(job);
+        fail_replies(job, err);
+        job->state = JOB_DONE;
+    } else if (job->state == JOB_RUNNING) {
+        finish_job(job, err);
+    }
+}
+
+/* Releases a job.  A queued job is cancelled.  A running job (e.g. after an
+   interruption) is orphaned: it is freed by the event loop when its
+   transfer process is done, so that releasing a job never blocks.  Jobs
+   whose transfer process writes to files shared with Yorick are killed
+   instead. */
+static void discard_job(job_t* job)
+{
+    if (job->state == JOB_RUNNING && ! job->cancel &&
+        orphans.running < orphans.max) {
+        pool_t* pool = job->pool;
+        worker_t* w = job->worker;
+        remove_active(pool, job);
+        unlink_worker(pool, w);
+        w->next = orphans.procs;
+        orphans.procs = w;
+        ++orphans.nprocs;
+        job->pool = &orphans;
+        job->next = orphans.active;
+        orphans.active = job;
+        ++orphans.running;
+        job->done = free_job;
+        start_jobs(pool);
+        return;
+    }
+    cancel_job(job, "interrupted");
+    free_job(job);
+}
+
+void Y__xpa_lanes(int argc)
+{
+    long dims[3];
+    long* ans;
+    int k;
+
+    if (argc > 1) {
+        y_error("expecting at most 1 argument");
+    }
+    if (argc == 1 && ! yarg_nil(0)) {
+        long n = ygets_l(0);
+        if (n < 1 || n > POOL_MAX) {
+            y_error("invalid number of bulk transfer processes");
+        }
+        bulk_workers.max = n;
+        trim_workers(&bulk_workers);
+        start_jobs(&bulk_workers);
+    }
+    dims[0] = 2;
+    dims[1] = 5;
+    dims[2] = 2;
+    ans = ypush_l(dims);
+    for (k = 0; k < 2; ++k) {
+        pool_t* pool = LANE_POOL(k);
+        ans[5*k + 0] = pool->running;
+        ans[5*k + 1] = pool->pending;
+        ans[5*k + 2] = pool->completed;
+        ans[5*k + 3] = pool->max;
+        ans[5*k + 4] = pool->nprocs;
+    }
+}
+
+/*---------------------------------------------------------------------------*/
+/* PARALLEL FAN-OUT */
+
+/* A list of jobs is stored in a Yorick object so that jobs get released even
+   though an error occurs. */
+typedef struct joblist {
+    long   count;
+    job_t* jobs[1];
+} joblist_t;
+
+static void free_joblist(void* addr)
+{
+    joblist_t* list = (joblist_t*)addr;
+    while (list->count > 0) {
+        job_t* job = list->jobs[--list->count];
+        if (job != NULL) {
+            discard_job(job);
+        }
+    }
+}
+
+static y_userobj_t joblist_type = {
+    "XPAJobList",
+    free_joblist,
+    NULL,
+    NULL,
+    NULL,
+    NULL
+};
+
+/* Runs the jobs of a list by transfer processes of the lane given by
+   `p->lane` and waits for them until `deadline` (as given by `stats_clock`,
+   a non-positive value meaning forever).  The jobs which have not completed
+   in time are cancelled (queued ones first so that they are not started)
+   and yield an error reply.  Yields whether all jobs completed in time. */
+static int run_jobs(joblist_t* list, const params_t* p, double deadline)
+{
+    long k;
+
+    for (k = 0; k < list->count; ++k) {
+        submit_job(lane_pool(p), list->jobs[k]);
+    }
+    for (k = 0; k < list->count; ++k) {
+        if (! wait_job(list->jobs[k], deadline)) {
+            char msg[64];
+            snprintf(msg, sizeof(msg), "timeout after %g s", p->timeout);
+            for (k = 0; k < list->count; ++k) {
+                if (list->jobs[k]->state == JOB_PENDING) {
+                    cancel_job(list->jobs[k], msg);
+                }
+            }
+            for (k = 0; k < list->count; ++k) {
+                cancel_job(list->jobs[k], msg);
+            }
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/* Moves the replies of the jobs of a list, in order, to the shared
+   replies. */
+static replies_t* collect_replies(joblist_t* list)
+{
+    replies_t* r;
+    long k;
+    int i, total = 0;
+
+    for (k = 0; k < list->count; ++k) {
+        total += list->jobs[k]->rep.count;
+    }
+    r = get_shared_replies(total);
+    for (k = 0; k < list->count; ++k) {
+        replies_t* src;
+        src = &list->jobs[k]->rep;
+        for (i = 0; i < src->count; ++i) {
+            int j = r->count++;
+            r->lens[j] = src->lens[i];
+            r->bufs[j] = src->bufs[i];
+            r->srvs[j] = src->srvs[i];
+            r->msgs[j] = src->msgs[i];
+            src->bufs[i] = NULL;
+            src->srvs[i] = NULL;
+            src->msgs[i] = NULL;
+        }
+        src->count = 0;
+    }
+    return r;
+}
+
+/* Pushes a list with a single new job for an XPA command to be run by
+   `run_jobs`.  This is used by the commands with a single access point
+   whose lane is not the shared connection.  The caller may then customize
+   the job. */
+static joblist_t* push_lane_job(params_t* p, int set)
+{
+    joblist_t* list;
+
+    list = (joblist_t*)ypush_obj(&joblist_type, sizeof(joblist_t));
+    if (p->data >= 0) {
+        ++p->data;
+    }
+    list->jobs[0] = new_job(set, p, 0);
+    list->count = 1;
+    return list;
+}
+
+/* Runs an XPA command for several access points in parallel (each one by a
+   transfer process of the lane given by `p->lane`) and pushes a single
+   XPAData object collecting all the replies in the order of the access
+   points.  If `p->timeout` is set, the commands which have not completed in
+   time are cancelled and yield an error reply. */
+static void fanout(params_t* p, int set)
+{
+    joblist_t* list;
+    double deadline;
+    long k;
+    int nmax = p->nmax;
+
+    /* Push the list of jobs, the data argument is one slot further. */
+    list = (joblist_t*)ypush_obj(&joblist_type,
+                                 offsetof(joblist_t, jobs) +
+                                 p->napts*sizeof(job_t*));
+    if (p->data >= 0) {
+        ++p->data;
+    }
+
+    /* Create all jobs before starting them.  The name server lookup for
+       `nmax=-1` is done by the transfer processes, hence within the
+       deadline. */
+    deadline = (p->timeout > 0.0 ? stats_clock() + p->timeout : 0.0);
+    for (k = 0; k < p->napts; ++k) {
+        p->apt = p->apts[k];
+        p->nmax = nmax;
+        list->jobs[k] = new_job(set, p, 0);
+        list->count = k + 1;
+    }
+    run_jobs(list, p, deadline);
+    push_xpadata(collect_replies(list));
+}
+
+/* Sends a FITS file by a transfer process of the lane given by `p->lane`
+   and yields the shared replies.  The header and the data (in native byte
+   order) are sent to the transfer process which writes the FITS file. */
+static replies_t* send_fits_in_lane(params_t* p, fits_writer_t* w)
+{
+    joblist_t* list;
+    job_t* job;
+
+    list = push_lane_job(p, 1);
+    job = list->jobs[0];
+    job->kind = JOB_FITS;
+    job->hdr = malloc(w->hdrlen);
+    if (job->hdr == NULL) {
+        y_error("insufficient memory");
+    }
+    memcpy(job->hdr, w->hdr, w->hdrlen);
+    job->hdrlen = w->hdrlen;
+    job->elsize = w->elsize;
+    job->swap = w->swap;
+    run_jobs(list, p, 0.0);
+    return collect_replies(list);
+}
+
+/*---------------------------------------------------------------------------*/
+/* ASYNCHRONOUS REQUESTS */
+
+typedef struct xparequest xparequest_t;
+struct xparequest {
+    job_t* job;
+    void*  ans;      /* Yorick use of the XPAData object once collected */
+    void*  self;     /* Yorick use of the request while watched */
+    void*  callback; /* Yorick use of the callback while watched */
+    xparequest_t* next; /* next completed request */
+};
+
+/* Completed requests whose callback has to be called. */
+static xparequest_t* completed_first = NULL;
+static xparequest_t* completed_last = NULL;
+
+static void free_xparequest(void* addr)
+{
+    xparequest_t* obj = (xparequest_t*)addr;
+    if (obj->job != NULL) {
+        job_t* job = obj->job;
+        obj->job = NULL;
+        discard_job(job);
+    }
+    if (obj->ans != NULL) {
+        ydrop_use(obj->ans);
+    }
+}
+
+static void print_xparequest(void* addr)
+{
+    xparequest_t* obj = (xparequest_t*)addr;
+    y_print("XPARequest (", 0);
+    if (obj->job == NULL) {
+        y_print("done)", 1);
+    } else {
+        job_t* job = obj->job;
+        y_print(job->set ? "set \"" : "get \"", 0);
+        y_print(job->apt, 0);
+        y_print(job->state == JOB_DONE ? "\", done)" : "\", pending)", 1);
+    }
+}
+
+/* Evaluating an asynchronous request waits for its completion and yields the
+   XPAData object collecting the replies. */
+static void eval_xparequest(void* addr, int argc)
+{
+    xparequest_t* obj = (xparequest_t*)addr;
+    if (argc != 1 || ! yarg_nil(0)) {
+        y_error("syntax is `req()` to wait for the replies");
+    }
+    if (obj->ans == NULL) {
+        job_t* job = obj->job;
+        wait_job(job, 0.0);
+        push_xpadata(&job->rep);
+        obj->ans = yget_use(0);
+        obj->job = NULL;
+        free_job(job);
+    } else {
+        ypush_use(obj->ans);
+    }
+}
+
+static void extract_xparequest(void* addr, char* name)
+{
+    xparequest_t* obj = (xparequest_t*)addr;
+    if (name[0] == 'r' && strcmp(name, "ready") == 0) {
+        job_t* job = obj->job;
+        if (job != NULL && job->state != JOB_DONE) {
+            /* Read what is available without waiting. */
+            poll_pool(job->pool, 0);
+        }
+        ypush_int(job == NULL || job->state == JOB_DONE);
+    } else {
+        y_error("bad XPARequest member");
+    }
+}
+
+static y_userobj_t xparequest_type = {
+    "XPARequest",
+    free_xparequest,
+    print_xparequest,
+    eval_xparequest,
+    extract_xparequest,
+    NULL
+};
+
+/* Queues a completed request and schedules a call to `_xpa_async_done` by
+   the interpreter to run its callback. */
+static void complete_request(xparequest_t* obj)
+{
+    obj->next = NULL;
+    if (completed_last == NULL) {
+        completed_first = obj;
+    } else {
+        completed_last->next = obj;
+    }
+    completed_last = obj;
+    push_string("_xpa_async_done;", -1);
+    yexec_include(0, 0);
+    yarg_drop(1);
+}
+
+/* Callback of the job of a watched request, called by the event loop as
+   soon as the transfer process has sent its replies. */
+static void request_done(job_t* job)
+{
+    complete_request((xparequest_t*)job->data);
+}
+
+void Y__xpa_async_watch(int argc)
+{
+    xparequest_t* obj;
+
+    if (argc != 2) {
+        y_error("expecting exactly 2 arguments");
+    }
+    obj = (xparequest_t*)yget_obj(1, &xparequest_type);
+    if (obj->self != NULL) {
+        y_error("request is already watched");
+    }
+    obj->self = yget_use(1);
+    obj->callback = yget_use(0);
+    if (obj->job == NULL || obj->job->state == JOB_DONE) {
+        complete_request(obj);
+    } else {
+        obj->job->data = obj;
+        obj->job->done = request_done;
+    }
+    ypush_nil();
+}
+
+void Y__xpa_async_next(int argc)
+{
+    xparequest_t* obj;
+    long ref;
+
+    if (argc != 1) {
+        y_error("expecting exactly 1 argument");
+    }
+    ref = yget_ref(0);
+    if (ref < 0) {
+        y_error("expecting a variable reference");
+    }
+    obj = completed_first;
+    if (obj == NULL) {
+        ypush_nil();
+        return;
+    }
+    completed_first = obj->next;
+    if (completed_first == NULL) {
+        completed_last = NULL;
+    }
+    obj->next = NULL;
+    ypush_use(obj->callback);
+    ydrop_use(obj->callback);
+    obj->callback = NULL;
+    yput_global(ref, 0);
+    yarg_drop(1);
+    ypush_use(obj->self);
+    ydrop_use(obj->self);
+    obj->self = NULL;
+}
+
+static void push_request(int argc, int set)
+{
+    xparequest_t* obj;
+    job_t* job;
+    params_t p;
+
+    /* The job must be created before pushing anything on the stack as it
+       may have to refer to the data argument. */
+    parse_params(argc, set, &p);
+    if (p.napts != 1) {
+        y_error("asynchronous requests take a single access point");
+    }
+    if (p.timeout > 0.0) {
+        y_error("keyword `timeout` is not supported by asynchronous "
+                "requests");
+    }
+    job = new_job(set, &p, 0);
+    obj = (xparequest_t*)ypush_obj(&xparequest_type, sizeof(xparequest_t));
+    obj->job = job;
+    submit_job(lane_pool(&p), job);
+}
+
+void Y__xpa_get_async(int argc)
+{
+    push_request(argc, 0);
+}
+
+void Y__xpa_set_async(int argc)
+{
+    push_request(argc, 1);
+}
+
+/*---------------------------------------------------------------------------*/
+/* BACKGROUND SENDER QUEUE */
+
+/* Fire-and-forget XPA set commands are queued and sent one after the other
+   by a single long-lived transfer process (so that the commands are
+   delivered in order) which keeps its connections to the servers.  The
+   data to send are copied so that the caller can immediately reuse its
+   arrays, they are streamed to the sender when the command starts.  The
+   queue is bounded and the policy applied when it is full is
+   configurable. */
+
+#define QUEUE_CAPACITY 16 /* default maximum number of queued commands */
+
+typedef enum {
+    QUEUE_BLOCK = 0,  /* wait until there is room in the queue */
+    QUEUE_DROP,       /* drop the oldest queued command */
+    QUEUE_COALESCE    /* replace queued command with same access point and
+                         command, drop the oldest one otherwise */
+} queue_policy_t;
+
+typedef struct sender {
+    pool_t  pool;     /* queued commands and command being sent */
+    long    capacity; /* maximum number of queued commands */
+    int     policy;
+    long    queued;   /* number of accepted commands */
+    long    sent;     /* number of sent commands */
+    long    dropped;  /* number of dropped commands */
+    long    errors;   /* number of error replies */
+} sender_t;
+
+static sender_t sender = {
+    {NULL, NULL, NULL, NULL, 0, 1, 0, 0, 0, NULL, 0},
+    QUEUE_CAPACITY, QUEUE_BLOCK, 0, 0, 0, 0
+};
+
+/* Callback of a sent command. */
+static void sender_done(job_t* job)
+{
+    sender_t* q = &sender;
+    int i;
+    for (i = 0; i < job->rep.count; ++i) {
+        if (job->rep.msgs[i] != NULL && IS_ERROR(job->rep.msgs[i])) {
+            ++q->errors;
+        }
+    }
+    ++q->sent;
+    free_job(job);
+}
+
+/* Commands still queued when Yorick exits are not sent, their number is
+   reported. */
+static int sender_atexit = 0;
+
+static void report_unsent(void)
+{
+    if (sender.pool.pending > 0) {
+        fprintf(stderr, "XPA: %ld queued command(s) not sent at exit "
+                "(call xpa_queue_flush to wait for them)\n",
+                sender.pool.pending);
+    }
+}
+
+/* Drops a queued command. */
+static void drop_job(sender_t* q, job_t* job)
+{
+    unqueue_job(job);
+    free_job(job);
+    ++q->dropped;
+}
+
+void Y_xpa_queue_set(int argc)
+{
+    sender_t* q = &sender;
+    params_t p;
+    job_t* job;
+    job_t* next;
+
+    /* Parse arguments and copy them in a new job. */
+    parse_params(argc, 1, &p);
+    if (p.napts != 1) {
+        y_error("queued requests take a single access point");
+    }
+    if (p.conn != NULL) {
+        y_error("keyword `conn` is not supported by queued requests");
+    }
+    if (p.timeout > 0.0) {
+        y_error("keyword `timeout` is not supported by queued requests");
+    }
+    job = new_job(1, &p, 1);
+    job->pool = &q->pool;
+    job->done = sender_done;
+
+    if (! sender_atexit) {
+        if (atexit(report_unsent) != 0) {
+            free_job(job);
+            y_error("atexit() failed");
+        }
+        sender_atexit = 1;
+    }
+
+    /* Collect the sent commands without waiting, so that the queue reflects
+       the progress of the sender even though the event loop has not run
+       (e.g. in a loop of the interpreter). */
+    poll_pool(&q->pool, 0);
+    if (q->policy == QUEUE_COALESCE) {
+        /* Replace a pending command with the same access point and command
+           at its place in the queue. */
+        job_t* prev = NULL;
+        for (next = q->pool.first; next != NULL; next = next->next) {
+            if (strcmp(next->apt, job->apt) == 0 &&
+                (next->cmd == NULL ? job->cmd == NULL :
+                 (job->cmd != NULL && strcmp(next->cmd, job->cmd) == 0))) {
+                job->next = next->next;
+                job->state = JOB_PENDING;
+                if (prev == NULL) {
+                    q->pool.first = job;
+                } else {
+                    prev->next = job;
+                }
+                if (q->pool.last == next) {
+                    q->pool.last = job;
+                }
+                free_job(next);
+                ++q->dropped;
+                ++q->queued;
+                return;
+            }
+            prev = next;
+        }
+    }
+    while (q->pool.pending >= q->capacity) {
+        if (q->policy == QUEUE_BLOCK) {
+            poll_pool(&q->pool, 100);
+            if (p_signalling) {
+                free_job(job);
+                p_abort();
+            }
+        } else {
+            drop_job(q, q->pool.first);
+        }
+    }
+    ++q->queued;
+    submit_job(&q->pool, job);
+}
+
+void Y_xpa_queue_config(int argc)
+{
+    sender_t* q = &sender;
+    long capacity = -1;
+    int policy = -1;
+
+    if (argc > 2) {
+        y_error("expecting at most 2 arguments");
+    }
+    if (argc >= 1 && ! yarg_nil(argc - 1)) {
+        capacity = ygets_l(argc - 1);
+        if (capacity < 1) {
+            y_error("queue capacity must be at least 1");
+        }
+    }
+    if (argc >= 2 && ! yarg_nil(argc - 2)) {
+        const char* str;
+        if (! IS_SCALAR_STRING(argc - 2)) {
+            y_error("queue policy must be a string");
+        }
+        str = ygets_q(argc - 2);
+        if (str != NULL && strcmp(str, "block") == 0) {
+            policy = QUEUE_BLOCK;
+        } else if (str != NULL && strcmp(str, "drop") == 0) {
+            policy = QUEUE_DROP;
+        } else if (str != NULL && strcmp(str, "coalesce") == 0) {
+            policy = QUEUE_COALESCE;
+        } else {
+            y_error("queue policy must be \"block\", \"drop\" or "
+                    "\"coalesce\"");
+        }
+    }
+    if (capacity > 0) {
+        q->capacity = capacity;
+    }
+    if (policy >= 0) {
+        q->policy = policy;
+    }
+}
+
+void Y__xpa_queue_stats(int argc)
+{
+    sender_t* q = &sender;
+    long dims[2];
+    long* ans;
+
+    if (argc > 1 || (argc == 1 && ! yarg_nil(0))) {
+        y_error("expecting no arguments");
+    }
+    dims[0] = 1;
+    dims[1] = 7;
+    ans = ypush_l(dims);
+    ans[0] = q->queued;
+    ans[1] = q->sent;
+    ans[2] = q->dropped;
+    ans[3] = q->errors;
+    ans[4] = q->pool.pending + q->pool.running;
+    ans[5] = q->capacity;
+    ans[6] = q->policy;
+}
+
+void Y_xpa_queue_flush(int argc)
+{
+    sender_t* q = &sender;
+
+    if (argc > 1 || (argc == 1 && ! yarg_nil(0))) {
+        y_error("expecting no arguments");
+    }
+    while (q->pool.pending > 0 || q->pool.running > 0) {
+        poll_pool(&q->pool, 100);
+        if (p_signalling) {
+            p_abort();
+        }
+    }
+}
+
+/*---------------------------------------------------------------------------*/
+/* DIRECT RECEPTION INTO ARRAYS OR FILES */
+
+/* Data received by `xpa_get_into` are streamed by XPAGetFd into a pipe
+   read by another thread directly into the destination array; in a
+   transfer process, they are read from its socket directly into the
+   destination array.  Data received by `xpa_get_fd` are written by
+   XPAGetFd to the destination files (one per recipient): directly for
+   regular files whose offsets give the number of bytes written, through a
+   pipe otherwise, the data being copied to the destination by another
+   thread which counts them.  Memory use is thus independent of the size of
+   the data.  The tables of destinations are reused so that steady-state
+   polling involves no allocations by the plug-in.  In the bulk lane,
+   XPAGetFd is called by a transfer process to which the destination files
+   are passed and which sends back the number of bytes written. */
+
+typedef struct dest {
+    int   owner; /* destination file must be closed? */
+} dest_t;
+
+static dest_t* dests = NULL; /* destinations of `xpa_get_fd` */
+static int* dest_fds = NULL; /* file descriptors of the destinations */
+static int dest_size = 0; /* number of allocated destinations */
+
+typedef struct counted_fd {
+    int       dst;    /* destination file */
+    off_t     start;  /* initial offset of a regular file (-1 otherwise) */
+    int       in;     /* read end of the pipe (if not a regular file) */
+    size_t    count;  /* number of bytes copied from the pipe */
+    int       status; /* 0 on success, error number otherwise */
+    pthread_t thread; /* thread copying the pipe to the destination */
+} counted_fd_t;
+
+static counted_fd_t* counted = NULL; /* destinations of `get_to_fds` */
+static int* counted_fds = NULL; /* files written by XPAGetFd */
+static int counted_size = 0; /* number of allocated destinations */
+
+typedef struct array_reader {
+    int    fd;     /* read end of the pipe */
+    char*  dst;    /* destination array */
+    size_t size;   /* size of destination array */
+    size_t count;  /* number of bytes received */
+    int    status; /* 0 on success, error number otherwise */
+} array_reader_t;
+
+/* Thread function reading the data written by XPAGetFd in a pipe directly
+   into the destination array until the pipe is closed.  Data in excess of
+   the size of the array are counted and discarded (so that the writer is
+   never blocked). */
+static void* array_reader(void* arg)
+{
+    array_reader_t* rd = (array_reader_t*)arg;
+    char scratch[4096];
+    char* dst;
+    size_t n;
+    ssize_t nr;
+
+    for (;;) {
+        if (rd->count < rd->size) {
+            dst = rd->dst + rd->count;
+            n = rd->size - rd->count;
+        } else {
+            dst = scratch;
+            n = sizeof(scratch);
+        }
+        nr = read(rd->fd, dst, n);
+        if (nr > 0) {
+            rd->count += nr;
+        } else if (nr == 0) {
+            break;
+        } else if (errno != EINTR) {
+            rd->status = errno;
+            break;
+        }
+    }
+    return NULL;
+}
+
+/* Thread function copying the data written by XPAGetFd in a pipe to the
+   destination and counting them.  After a write error, the data are
+   drained so that the writer is never blocked. */
+static void* fd_copier(void* arg)
+{
+    counted_fd_t* c = (counted_fd_t*)arg;
+    char buf[65536];
+    ssize_t nr;
+
+    for (;;) {
+        nr = read(c->in, buf, sizeof(buf));
+        if (nr > 0) {
+            if (c->status == 0) {
+                c->status = write_all(c->dst, buf, nr);
+                if (c->status == 0) {
+                    c->count += nr;
+                }
+            }
+        } else if (nr == 0 || errno != EINTR) {
+            break;
+        }
+    }
+    return NULL;
+}
+
+/* Receives, by XPAGetFd with the handle `xpa`, the data of at most `n`
+   recipients into the files `fds` (one per recipient) and stores in
+   `r->lens` the number of bytes written for each reply.  A write error is
+   reported in the message of the reply.  Yields the number of replies, -1
+   if the pipes or the threads cannot be created. */
+static int get_to_fds(XPA xpa, char* apt, char* cmd, char* mode,
+                      const int* fds, int n, replies_t* r)
+{
+    struct stat st;
+    counted_fd_t* c;
+    char msg[100];
+    off_t end;
+    int i, k, m, pfd[2];
+
+    if (counted_size < n) {
+        counted_fd_t* tab = (counted_fd_t*)malloc(n*sizeof(counted_fd_t));
+        int* tmp = (int*)malloc(n*sizeof(int));
+        if (tab == NULL || tmp == NULL) {
+            free(tab);
+            free(tmp);
+            return -1;
+        }
+        free(counted);
+        free(counted_fds);
+        counted = tab;
+        counted_fds = tmp;
+        counted_size = n;
+    }
+    for (m = 0; m < n; ++m) {
+        c = &counted[m];
+        c->dst = fds[m];
+        c->count = 0;
+        c->status = 0;
+        c->start = -1;
+        if (fstat(c->dst, &st) == 0 && S_ISREG(st.st_mode)) {
+            c->start = lseek(c->dst, 0, SEEK_CUR);
+        }
+        if (c->start >= 0) {
+            counted_fds[m] = c->dst;
+            continue;
+        }
+        if (pipe(pfd) != 0) {
+            break;
+        }
+        c->in = pfd[0];
+        counted_fds[m] = pfd[1];
+        if (pthread_create(&c->thread, NULL, fd_copier, c) != 0) {
+            close(pfd[0]);
+            close(pfd[1]);
+            break;
+        }
+    }
+    k = (m < n ? -1 : XPAGetFd(xpa, apt, cmd, mode, counted_fds,
+                               r->srvs, r->msgs, -n));
+    for (i = 0; i < m; ++i) {
+        c = &counted[i];
+        if (c->start < 0) {
+            close(counted_fds[i]);
+            pthread_join(c->thread, NULL);
+            close(c->in);
+        }
+    }
+    for (i = 0; i < k; ++i) {
+        c = &counted[i];
+        if (c->start >= 0) {
+            end = lseek(c->dst, 0, SEEK_CUR);
+            r->lens[i] = (end > c->start ? (size_t)(end - c->start) : 0);
+        } else {
+            r->lens[i] = c->count;
+        }
+        if (c->status != 0) {
+            snprintf(msg, sizeof(msg), "XPA$ERROR failed to write data (%s)\n",
+                     strerror(c->status));
+            free(r->msgs[i]);
+            r->msgs[i] = strdup(msg);
+        }
+    }
+    return k;
+}
+
+/* Makes sure that there are at least `n` destinations. */
+static void reserve_dests(int n)
+{
+    if (dest_size < n) {
+        dest_t* d = (dest_t*)malloc(n*sizeof(dest_t));
+        int* fds = (int*)malloc(n*sizeof(int));
+        if (d == NULL || fds == NULL) {
+            free(d);
+            free(fds);
+            y_error("insufficient memory");
+        }
+        free(dests);
+        free(dest_fds);
+        dests = d;
+        dest_fds = fds;
+        dest_size = n;
+    }
+}
+
+/* Closes the files owned by the first `n` destinations and yields the error
+   number of the first failure (0 if none). */
+static int close_dests(int n)
+{
+    int i, err = 0;
+    for (i = 0; i < n; ++i) {
+        if (dests[i].owner) {
+            dests[i].owner = 0;
+            if (close(dest_fds[i]) != 0 && err == 0) {
+                err = errno;
+            }
+        }
+    }
+    return err;
+}
+
+void Y_xpa_get_into(int argc)
+{
+    array_reader_t rd;
+    pthread_t thread;
+    XPA xpa;
+    replies_t* r;
+    params_t p;
+    size_t count = 0;
+    double t0;
+    int fds[2], n;
+
+    /* Parse arguments as for a set command, the data being the destination
+       array. */
+    parse_params(argc, PARSE_SET, &p);
+    if (p.napts != 1) {
+        y_error("expecting a single access point");
+    }
+    if (p.nmax != 1) {
+        y_error("only one recipient is allowed");
+    }
+    if (p.data < 0 || yarg_rank(p.data) < 1) {
+        y_error("expecting a destination array");
+    }
+
+    /* Receive the data directly into the array. */
+    if (p.lane != LANE_CONTROL) {
+        joblist_t* list;
+        job_t* job;
+        double deadline;
+        int done;
+        deadline = (p.timeout > 0.0 ? stats_clock() + p.timeout : 0.0);
+        list = push_lane_job(&p, 0);
+        job = list->jobs[0];
+        job->dest = p.buf;
+        job->destlen = p.len;
+        job->cancel = 1;
+        done = run_jobs(list, &p, deadline);
+        r = collect_replies(list);
+        if (! done) {
+            /* Ignore data received before the timeout. */
+            count = 0;
+        } else if (job->filled) {
+            count = p.len;
+        } else if (r->count > 0 && r->bufs[0] != NULL) {
+            count = r->lens[0];
+        }
+    } else {
+        xpa = get_handle(&p);
+        r = get_shared_replies(1);
+        if (pipe(fds) != 0) {
+            y_error("failed to create pipe");
+        }
+        rd.fd = fds[0];
+        rd.dst = p.buf;
+        rd.size = p.len;
+        rd.count = 0;
+        rd.status = 0;
+        if (pthread_create(&thread, NULL, array_reader, &rd) != 0) {
+            close(fds[0]);
+            close(fds[1]);
+            y_error("failed to start reader thread");
+        }
+        begin_timeout(&p);
+        t0 = latency_start();
+        n = XPAGetFd(xpa, p.apt, p.cmd, MODE(&p), &fds[1], r->srvs, r->msgs,
+                     -1);
+        latency_record(p.apt, t0);
+        end_timeout();
+        close(fds[1]);
+        pthread_join(thread, NULL);
+        close(fds[0]);
+        r->count = (n > 0 ? n : 0);
+        if (rd.status != 0) {
+            clear_replies(r);
+            y_error("failed to read received data");
+        }
+        count = rd.count;
+    }
+
+    /* Check the size of the data. */
+    if (count > 0 && count != p.len) {
+        clear_replies(r);
+        y_error("size of received data does not match that of the array");
+    }
+    if (r->count > 0) {
+        if (r->bufs[0] != NULL) {
+            free(r->bufs[0]);
+            r->bufs[0] = NULL;
+        }
+        r->lens[0] = count;
+    }
+    push_xpadata(r);
+}
+
+void Y_xpa_get_fd(int argc)
+{
+    joblist_t* list = NULL;
+    XPA xpa;
+    replies_t* r;
+    params_t p;
+    double t0;
+    long k, ndst;
+    int i, n, err, typeid;
+
+    /* Parse arguments. */
+    parse_params(argc, PARSE_DEST, &p);
+    if (p.napts != 1) {
+        y_error("expecting a single access point");
+    }
+    resolve_nmax(&p, 0);
+    n = p.nmax;
+    typeid = yarg_typeid(p.data);
+    if (IS_STRING(typeid) || IS_INTEGER(typeid)) {
+        ndst = 1;
+        if (yarg_rank(p.data) > 0) {
+            ygeta_any(p.data, &ndst, NULL, &typeid);
+        }
+    } else {
+        y_error("destination must be file name(s) or file descriptor(s)");
+    }
+    if (ndst != n) {
+        y_error("there must be one destination per recipient");
+    }
+    reserve_dests(n);
+    if (p.lane == LANE_BULK) {
+        /* Create the job first so that no error can occur once the
+           destination files are open.  The destinations are passed to the
+           transfer process. */
+        if (n > PASS_MAX) {
+            y_error("too many destinations for the bulk lane");
+        }
+        list = push_lane_job(&p, 0);
+        list->jobs[0]->kind = JOB_GETFD;
+        list->jobs[0]->fds = dest_fds;
+        list->jobs[0]->nfds = n;
+        list->jobs[0]->cancel = 1;
+    }
+
+    /* Open destination files. */
+    if (IS_STRING(typeid)) {
+        char** names = ygeta_q(p.data, NULL, NULL);
+        for (k = 0; k < n; ++k) {
+            if (names[k] == NULL) {
+                close_dests(k);
+                y_error("invalid null file name");
+            }
+            dest_fds[k] = open(names[k], O_WRONLY|O_CREAT|O_TRUNC, 0666);
+            if (dest_fds[k] < 0) {
+                close_dests(k);
+                y_errorq("failed to open file \"%s\" for writing", names[k]);
+            }
+            dests[k].owner = 1;
+        }
+    } else {
+        long* fds = ygeta_l(p.data, NULL, NULL);
+        for (k = 0; k < n; ++k) {
+            if (fds[k] < 0 || fds[k] > INT_MAX) {
+                y_error("invalid file descriptor");
+            }
+            dest_fds[k] = fds[k];
+            dests[k].owner = 0;
+        }
+    }
+
+    /* Receive the data, one destination per recipient, and the number of
+       bytes written to each one. */
+    if (list != NULL) {
+        run_jobs(list, &p, 0.0);
+        r = collect_replies(list);
+    } else {
+        xpa = get_handle(&p);
+        r = get_shared_replies(n);
+        t0 = latency_start();
+        i = get_to_fds(xpa, p.apt, p.cmd, MODE(&p), dest_fds, n, r);
+        latency_record(p.apt, t0);
+        if (i < 0) {
+            close_dests(n);
+            y_error("failed to start data copy");
+        }
+        r->count = i;
+    }
+    err = close_dests(n);
+    if (err != 0) {
+        clear_replies(r);
+        y_error(strerror(err));
+    }
+    push_xpadata(r);
+}
+
+/*---------------------------------------------------------------------------*/
+/* SENDING DATA FROM FILES */
+
+void Y_xpa_set_file(int argc)
+{
+    struct stat st;
+    joblist_t* list = NULL;
+    XPA xpa;
+    replies_t* r;
+    params_t p;
+    char* path;
+    char* map;
+    size_t maplen, len;
+    double t0;
+    int fd, n;
+
+    /* Parse arguments. */
+    parse_params(argc, PARSE_FILE, &p);
+    if (p.napts != 1) {
+        y_error("expecting a single access point");
+    }
+    if (! IS_SCALAR_STRING(p.data) || (path = ygets_q(p.data)) == NULL) {
+        y_error("expecting a file name");
+    }
+    if (p.lane != LANE_CONTROL) {
+        /* The file is passed to a transfer process of the lane which
+           maps it, the job owns the file. */
+        list = push_lane_job(&p, 1);
+    } else {
+        resolve_nmax(&p, 1);
+        xpa = get_handle(&p);
+        r = get_shared_replies(p.nmax);
+    }
+
+    /* Check the requested part of the file. */
+    fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        y_errorq("failed to open file \"%s\" for reading", path);
+    }
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        y_error("failed to retrieve file size");
+    }
+    if (p.offset > st.st_size) {
+        close(fd);
+        y_error("offset is beyond the end of the file");
+    }
+    if (p.length < 0) {
+        len = st.st_size - p.offset;
+    } else {
+        if (p.length > st.st_size - p.offset) {
+            close(fd);
+            y_error("offset + length is beyond the end of the file");
+        }
+        len = p.length;
+    }
+
+    /* Send the data. */
+    if (list != NULL) {
+        job_t* job = list->jobs[0];
+        job->kind = JOB_FILE;
+        job->file = fd;
+        job->fds = &job->file;
+        job->nfds = 1;
+        job->offset = p.offset;
+        job->len = len;
+        run_jobs(list, &p, 0.0);
+        push_xpadata(collect_replies(list));
+        return;
+    }
+    map = map_file(fd, p.offset, len, &maplen);
+    close(fd);
+    if (map == MAP_FAILED) {
+        y_error("failed to map file in memory");
+    }
+    t0 = latency_start();
+    n = XPASet(xpa, p.apt, p.cmd, MODE(&p),
+               (map == NULL ? NULL : map + (maplen - len)), len,
+               r->srvs, r->msgs, p.nmax);
+    latency_record(p.apt, t0);
+    r->count = (n > 0 ? n : 0);
+    if (map != NULL) {
+        munmap(map, maplen);
+    }
+    push_xpadata(r);
+}
+
+/*---------------------------------------------------------------------------*/
+/* XPA SERVER */
+
+/* Access points served by Yorick are created by XPANew.  Their sockets (as
+   given by XPAAddSelect) are watched by the event loop of Yorick which,
+   when a request arrives, queues a call to the `_xpa_poll` builtin.  The
+   sockets are not watched until this call has run so that the request is
+   signaled only once.  The XPA callbacks are called by XPAPoll (from
+   `_xpa_poll` or `xpa_serve`) and call the Yorick handlers via an
+   interpreted dispatcher, `_xpa_server_dispatch`, executed immediately by
+   `yexec_include`.  The handler, its arguments and its result are exchanged
+   through global variables.  Errors in the handlers are caught by the
+   dispatcher and reported to the XPA client: the callbacks must never raise
+   Yorick errors as this would longjmp through XPA code.  XPA client
+   commands are run with `doxpa=false` while there are servers (see
+   `noxpa_mode`) so XPAPoll is the only place where requests are served. */
+
+#define SERVER_CLASS "YORICK" /* default class of access points */
+
+typedef struct server server_t;
+struct server {
+    server_t* next;   /* next server in list */
+    XPA       xpa;    /* XPA access point (NULL if not yet created) */
+    void*     send;   /* Yorick use of the send handler (or NULL) */
+    void*     recv;   /* Yorick use of the receive handler (or NULL) */
+    char*     name;   /* "class:name" of the access point */
+    void*     data;   /* Yorick use of the published array (or NULL) */
+    void*     addr;   /* address of the published data */
+    size_t    size;   /* size of the published data (in bytes) */
+    long      version;/* number of times data have been published */
+    void**    slots;  /* Yorick uses of the arrays receiving data */
+    char**    bases;  /* addresses of the arrays receiving data */
+    size_t    slotsize;/* size of the arrays receiving data (in bytes) */
+    long      slotdims[Y_DIMSIZE]; /* dimensions of the receiving arrays */
+    int       slottype;/* type of the receiving arrays */
+    int       nslots; /* number of arrays receiving data */
+    int       slot;   /* 1-based index of last filled array (0 if none) */
+    long      seq;    /* number of data received into the arrays */
+    long      gets;   /* number of served get requests */
+    long      sets;   /* number of served set requests */
+    int       closed; /* object has been discarded while serving */
+};
+
+static server_t* servers = NULL; /* list of servers */
+static int serving = 0; /* XPAPoll is running */
+static int poll_queued = 0; /* a call to `_xpa_poll` has been queued */
+static fd_set watched_fds; /* sockets watched by the event loop */
+static int watched_max = -1; /* largest watched socket (-1 if none) */
+
+static int have_servers()
+{
+    return (servers != NULL);
+}
+
+/* Makes the event loop stop watching the sockets of the servers. */
+static void unwatch_servers()
+{
+    int fd;
+    for (fd = 0; fd <= watched_max; ++fd) {
+        if (FD_ISSET(fd, &watched_fds)) {
+            u_event_src(fd, NULL, NULL);
+        }
+    }
+    FD_ZERO(&watched_fds);
+    watched_max = -1;
+}
+
+/* Callback of the event loop when a request arrives. */
+static void on_server_input(void* context)
+{
+    if (poll_queued) {
+        return;
+    }
+    poll_queued = 1;
+    unwatch_servers();
+    push_string("_xpa_poll;", -1);
+    yexec_include(0, 0);
+    yarg_drop(1);
+}
+
+/* Makes the event loop watch the current sockets of the servers (the
+   listening sockets and the connections of requests in progress) and only
+   them.  Must be called after anything which may have opened or closed
+   them (XPANew, XPAFree and XPAPoll).  Nothing is watched while a call to
+   `_xpa_poll` is queued or while serving. */
+static void watch_servers()
+{
+    fd_set fds;
+    int fd, want, have, max = -1;
+
+    FD_ZERO(&fds);
+    if (servers != NULL && ! poll_queued && ! serving) {
+        XPAAddSelect(NULL, &fds);
+    }
+    for (fd = 0; fd < FD_SETSIZE; ++fd) {
+        want = FD_ISSET(fd, &fds);
+        have = (fd <= watched_max && FD_ISSET(fd, &watched_fds));
+        if (want && ! have) {
+            u_event_src(fd, on_server_input, NULL);
+        } else if (have && ! want) {
+            u_event_src(fd, NULL, NULL);
+        }
+        if (want) {
+            max = fd;
+        }
+    }
+    watched_fds = fds;
+    watched_max = max;
+}
+
+static long index_of_server_func = -1;
+static long index_of_server_params = -1;
+static long index_of_server_data = -1;
+static long index_of_server_result = -1;
+static long index_of_server_error = -1;
+
+static void destroy_server(server_t* srv)
+{
+    server_t** prev = &servers;
+    while (*prev != NULL) {
+        if (*prev == srv) {
+            *prev = srv->next;
+            break;
+        }
+        prev = &(*prev)->next;
+    }
+    if (srv->xpa != NULL) {
+        /* The sockets closed by XPAFree must not remain watched. */
+        unwatch_servers();
+        XPAFree(srv->xpa);
+        watch_servers();
+    }
+    if (srv->send != NULL) {
+        ydrop_use(srv->send);
+    }
+    if (srv->recv != NULL) {
+        ydrop_use(srv->recv);
+    }
+    if (srv->data != NULL) {
+        ydrop_use(srv->data);
+    }
+    if (srv->slots != NULL) {
+        int k;
+        for (k = 0; k < srv->nslots; ++k) {
+            if (srv->slots[k] != NULL) {
+                ydrop_use(srv->slots[k]);
+            }
+        }
+        free(srv->slots);
+    }
+    free(srv->bases);
+    free(srv->name);
+    free(srv);
+}
+
+/* Destroys the servers which have been discarded while serving. */
+static void reap_servers()
+{
+    server_t* srv = servers;
+    while (srv != NULL) {
+        server_t* next = srv->next;
+        if (srv->closed) {
+            destroy_server(srv);
+        }
+        srv = next;
+    }
+}
+
+/* Stores the top-most stack element in a global variable and drops it. */
+static void put_global(long index)
+{
+    yput_global(index, 0);
+    yarg_drop(1);
+}
+
+/* Calls the Yorick handler `func` with the request parameters (and the
+   received data if `data` is not NULL) and leaves the result and the error
+   message (if any) in the corresponding global variables. */
+static void call_handler(void* func, const char* paramlist,
+                         const char* data, size_t len)
+{
+    char** code;
+    long dims[2];
+
+    if (index_of_server_func < 0) {
+        index_of_server_func = yget_global("_xpa_server_func", 0);
+        index_of_server_params = yget_global("_xpa_server_params", 0);
+        index_of_server_data = yget_global("_xpa_server_data", 0);
+        index_of_server_result = yget_global("_xpa_server_result", 0);
+        index_of_server_error = yget_global("_xpa_server_error", 0);
+    }
+    ypush_use(func);
+    put_global(index_of_server_func);
+    push_string(paramlist, -1);
+    put_global(index_of_server_params);
+    if (data != NULL && len > 0) {
+        dims[0] = 1;
+        dims[1] = len;
+        memcpy(ypush_c(dims), data, len);
+    } else {
+        ypush_nil();
+    }
+    put_global(index_of_server_data);
+    ypush_nil();
+    put_global(index_of_server_result);
+    ypush_nil();
+    put_global(index_of_server_error);
+
+    /* Execute the dispatcher now. */
+    code = ypush_q(NULL);
+    code[0] = p_strcpy((data != NULL ? "_xpa_server_dispatch, 1;"
+                        : "_xpa_server_dispatch, 0;"));
+    yexec_include(0, 1);
+    yarg_drop(1);
+
+    /* Release the received data as soon as possible. */
+    ypush_nil();
+    put_global(index_of_server_data);
+}
+
+/* Reports the error set by the handler (if any) to the client.  Returns -1
+   if there was an error, 0 otherwise. */
+static int report_error(XPA xpa)
+{
+    int status = 0;
+    ypush_global(index_of_server_error);
+    if (! yarg_nil(0)) {
+        const char* msg = (yarg_string(0) == 1 ? ygets_q(0) : NULL);
+        XPAError(xpa, (char*)(msg != NULL ? msg : "error in Yorick handler"));
+        status = -1;
+    }
+    yarg_drop(1);
+    return status;
+}
+
+static int server_send(void* client_data, void* call_data, char* paramlist,
+                       char** buf, size_t* len)
+{
+    server_t* srv = (server_t*)client_data;
+    XPA xpa = (XPA)call_data;
+    long i, ntot;
+    int typeid, status = 0;
+    void* ptr;
+
+    *buf = NULL;
+    *len = 0;
+    if (! srv->closed && srv->data != NULL) {
+        /* Published array: its memory is directly sent (the access point
+           has been created with `freebuf=false`) and the Yorick use held by
+           the server guarantees that it remains valid during the transfer
+           which completes before any other Yorick code can run. */
+        ++srv->gets;
+        *buf = srv->addr;
+        *len = srv->size;
+        return 0;
+    }
+    if (srv->closed || srv->send == NULL) {
+        XPAError(xpa, "no Yorick send handler for this access point");
+        return -1;
+    }
+    ++srv->gets;
+    call_handler(srv->send, paramlist, NULL, 0);
+    if (report_error(xpa) != 0) {
+        return -1;
+    }
+
+    /* Copy the result in a buffer which will be freed by XPA.  Strings are
+       sent as lines of text, numerical arrays as their raw contents. */
+    ypush_global(index_of_server_result);
+    typeid = yarg_typeid(0);
+    if (typeid == Y_STRING) {
+        char** str = ygeta_q(0, &ntot, NULL);
+        size_t size = 0;
+        for (i = 0; i < ntot; ++i) {
+            size += (str[i] != NULL ? strlen(str[i]) : 0) + 1;
+        }
+        *buf = malloc(size);
+        if (*buf != NULL) {
+            char* dst = *buf;
+            for (i = 0; i < ntot; ++i) {
+                size_t n = (str[i] != NULL ? strlen(str[i]) : 0);
+                memcpy(dst, str[i], n);
+                dst[n] = '\n';
+                dst += n + 1;
+            }
+            *len = size;
+        }
+    } else if (typeid >= Y_CHAR && typeid <= Y_COMPLEX) {
+        ptr = ygeta_any(0, &ntot, NULL, &typeid);
+        *len = ntot*elem_size(typeid);
+        *buf = malloc(*len);
+        if (*buf != NULL) {
+            memcpy(*buf, ptr, *len);
+        }
+    } else if (typeid != Y_VOID) {
+        XPAError(xpa, "Yorick send handler must return a string or a "
+                 "numerical array");
+        status = -1;
+    }
+    if (*len > 0 && *buf == NULL) {
+        *len = 0;
+        XPAError(xpa, "insufficient memory");
+        status = -1;
+    }
+    yarg_drop(1);
+    ypush_nil();
+    put_global(index_of_server_result);
+    return status;
+}
+
+/* Yields the maximum number of seconds to wait for the data of a request,
+   that is XPA long timeout (XPA_LONG_TIMEOUT, 180 s by default). */
+static double long_timeout(void)
+{
+    const char* str = getenv("XPA_LONG_TIMEOUT");
+    double val = (str == NULL ? 0.0 : atof(str));
+    return (val > 0.0 ? val : 180.0);
+}
+
+/* Reads exactly `size` bytes from the data socket of an XPA request into
+   `dst`.  Returns 0 on success, -1 if there are not enough data, +1 if
+   there are too many data (which are discarded), -2 on timeout and -3 if
+   interrupted by the user.  An error is reported to the client in case of
+   failure.  Interrupts are checked every 0.1 s but not handled here (this
+   is called by XPA) so that the interpreter handles them afterwards. */
+static int read_slot(XPA xpa, char* dst, size_t size)
+{
+    char extra[4096];
+    struct pollfd pfd;
+    ssize_t n;
+    double deadline = stats_clock() + long_timeout();
+    int fd = xpa_datafd(xpa);
+    int status = 0;
+
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+    while (fd >= 0) {
+        if (size > 0) {
+            n = read(fd, dst, size);
+        } else {
+            n = read(fd, extra, sizeof(extra));
+        }
+        if (n > 0) {
+            if (size > 0) {
+                dst += n;
+                size -= n;
+            } else {
+                status = 1;
+            }
+        } else if (n == 0) {
+            break;
+        } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            if (p_signalling) {
+                status = -3;
+                break;
+            }
+            if (stats_clock() >= deadline) {
+                status = -2;
+                break;
+            }
+            poll(&pfd, 1, 100);
+        } else if (errno != EINTR) {
+            break;
+        }
+    }
+    if (status == 0 && size > 0) {
+        status = -1;
+    }
+    if (status != 0) {
+        XPAError(xpa, (status == -1 ? "not enough data for receiving array" :
+                       status == -2 ? "timeout while receiving array" :
+                       status == -3 ? "interrupted while receiving array" :
+                       "too many data for receiving array"));
+    }
+    return status;
+}
+
+static int server_recv(void* client_data, void* call_data, char* paramlist,
+                       char* buf, size_t len)
+{
+    server_t* srv = (server_t*)client_data;
+    XPA xpa = (XPA)call_data;
+
+    if (! srv->closed && srv->nslots > 0) {
+        /* The access point has been created with `fillbuf=false`: the data
+           are directly read into the next array of the ring. */
+        int k = srv->slot % srv->nslots;
+        ++srv->sets;
+        if (read_slot(xpa, srv->bases[k], srv->slotsize) != 0) {
+            return -1;
+        }
+        srv->slot = k + 1;
+        ++srv->seq;
+        return 0;
+    }
+    if (srv->closed || srv->recv == NULL) {
+        XPAError(xpa, "no Yorick receive handler for this access point");
+        return -1;
+    }
+    ++srv->sets;
+    call_handler(srv->recv, paramlist, (buf != NULL ? buf : ""), len);
+    return report_error(xpa);
+}
+
+typedef struct xpaserver {
+    server_t* srv;
+} xpaserver_t;
+
+static void free_xpaserver(void* addr)
+{
+    server_t* srv = ((xpaserver_t*)addr)->srv;
+    if (srv != NULL) {
+        srv->closed = 1;
+        if (! serving) {
+            destroy_server(srv);
+        }
+    }
+}
+
+static void print_xpaserver(void* addr)
+{
+    server_t* srv = ((xpaserver_t*)addr)->srv;
+    y_print("XPAServer (", 0);
+    y_print(srv->name, 0);
+    y_print(")", 1);
+}
+
+static void extract_xpaserver(void* addr, char* name)
+{
+    server_t* srv = ((xpaserver_t*)addr)->srv;
+    if (strcmp(name, "name") == 0) {
+        push_string(srv->name, -1);
+    } else if (strcmp(name, "gets") == 0) {
+        ypush_long(srv->gets);
+    } else if (strcmp(name, "sets") == 0) {
+        ypush_long(srv->sets);
+    } else if (strcmp(name, "version") == 0) {
+        ypush_long(srv->version);
+    } else if (strcmp(name, "seq") == 0) {
+        ypush_long(srv->seq);
+    } else if (strcmp(name, "slot") == 0) {
+        ypush_int(srv->slot);
+    } else if (strcmp(name, "slots") == 0) {
+        ypush_int(srv->nslots);
+    } else {
+        y_error("bad XPAServer member");
+    }
+}
+
+/* Evaluating a server receiving data as `srv(k)` yields its `k`-th array,
+   `srv()` yields the last filled one (nil if none). */
+static void eval_xpaserver(void* addr, int argc)
+{
+    server_t* srv = ((xpaserver_t*)addr)->srv;
+    long k;
+    if (srv->nslots < 1) {
+        y_error("XPA server was not created by xpa_receive");
+    }
+    if (argc != 1) {
+        y_error("syntax is `srv()` or `srv(k)`");
+    }
+    k = (yarg_nil(0) ? srv->slot : ygets_l(0));
+    if (k <= 0 && ! yarg_nil(0)) {
+        k += srv->nslots;
+    }
+    if (k < 0 || k > srv->nslots) {
+        y_error("out of range array index");
+    }
+    if (k == 0) {
+        ypush_nil();
+    } else {
+        ypush_use(srv->slots[k - 1]);
+    }
+}
+
+static y_userobj_t xpaserver_type = {
+    "XPAServer",
+    free_xpaserver,
+    print_xpaserver,
+    eval_xpaserver,
+    extract_xpaserver,
+    NULL
+};
+
+/* Checks that argument `iarg` is a function or nil and yields a Yorick use
+   of it (or NULL). */
+static void* get_handler(int iarg)
+{
+    if (yarg_nil(iarg)) {
+        return NULL;
+    }
+    if (! yarg_func(iarg)) {
+        y_error("handler must be a function");
+    }
+    return yget_use(iarg);
+}
+
+/* Pushes a new server object for access point `apt` (the XPA access point
+   itself is not yet created). */
+static server_t* push_server(const char* apt)
+{
+    xpaserver_t* obj;
+    server_t* srv;
+    size_t len;
+
+    if (apt == NULL || apt[0] == '\0') {
+        y_error("invalid access point name");
+    }
+
+    /* Create the server object first so that resources are released in case
+       of errors. */
+    obj = (xpaserver_t*)ypush_obj(&xpaserver_type, sizeof(xpaserver_t));
+    srv = (server_t*)malloc(sizeof(server_t));
+    if (srv == NULL) {
+        y_error("insufficient memory");
+    }
+    memset(srv, 0, sizeof(server_t));
+    srv->next = servers;
+    servers = srv;
+    obj->srv = srv;
+    len = strlen(apt);
+    if (strchr(apt, ':') == NULL) {
+        srv->name = malloc(sizeof(SERVER_CLASS) + len + 1);
+        if (srv->name != NULL) {
+            sprintf(srv->name, "%s:%s", SERVER_CLASS, apt);
+        }
+    } else {
+        srv->name = strdup(apt);
+    }
+    if (srv->name == NULL) {
+        y_error("insufficient memory");
+    }
+    return srv;
+}
+
+/* Registers the XPA access point of a server. */
+static void register_server(server_t* srv, const char* help,
+                            const char* send_mode, const char* recv_mode)
+{
+    char* sep = strchr(srv->name, ':');
+    *sep = '\0';
+    srv->xpa = XPANew(srv->name, sep + 1, (char*)help,
+                      (srv->send != NULL || srv->data != NULL ?
+                       server_send : NULL), srv, (char*)send_mode,
+                      (srv->recv != NULL || srv->nslots > 0 ?
+                       server_recv : NULL), srv, (char*)recv_mode);
+    *sep = ':';
+    if (srv->xpa == NULL) {
+        y_errorq("failed to register XPA access point \"%s\"", srv->name);
+    }
+    watch_servers();
+}
+
+void Y__xpa_server(int argc)
+{
+    server_t* srv;
+    const char* apt;
+    const char* help;
+
+    if (argc != 4) {
+        y_error("expecting exactly 4 arguments");
+    }
+    apt = ygets_q(argc - 1);
+    if (yarg_nil(argc - 2) && yarg_nil(argc - 3)) {
+        y_error("at least one handler must be specified");
+    }
+    help = (yarg_nil(argc - 4) ? NULL : ygets_q(argc - 4));
+    srv = push_server(apt);
+    srv->send = get_handler(argc - 1);
+    srv->recv = get_handler(argc - 2);
+    register_server(srv, help, NULL, NULL);
+}
+
+/* Binds the array at `iarg` to a server, copying it if `snapshot` is true.
+   Any previously published array is released.  This is safe even when
+   called from a Yorick handler as transfers of published data are
+   completed before any handler is called. */
+static void publish_array(server_t* srv, int iarg, int snapshot)
+{
+    long dims[Y_DIMSIZE];
+    long ntot;
+    int typeid = Y_VOID;
+    void* ptr;
+    void* use;
+
+    if (! yarg_number(iarg) && yarg_typeid(iarg) != Y_CHAR) {
+        y_error("published data must be a numerical array");
+    }
+    /* A scalar is stored in the stack slot, not in an array object which
+       could be referenced, so it is always copied. */
+    if (yarg_rank(iarg) < 1) {
+        snapshot = 1;
+    }
+    ptr = ygeta_any(iarg, &ntot, dims, &typeid);
+    if (snapshot) {
+        void* cpy = push_array(typeid, dims);
+        memcpy(cpy, ptr, ntot*elem_size(typeid));
+        ptr = cpy;
+        iarg = 0;
+    }
+    use = yget_use(iarg);
+    if (snapshot) {
+        yarg_drop(1);
+    }
+    if (srv->data != NULL) {
+        ydrop_use(srv->data);
+    }
+    srv->data = use;
+    srv->addr = ptr;
+    srv->size = ntot*elem_size(typeid);
+    ++srv->version;
+}
+
+void Y__xpa_publish(int argc)
+{
+    server_t* srv;
+    const char* help;
+    int snapshot;
+
+    if (argc != 4) {
+        y_error("expecting exactly 4 arguments");
+    }
+    snapshot = yarg_true(argc - 4);
+    if (yarg_typeid(argc - 1) == Y_OPAQUE) {
+        /* Update the array published by an existing server. */
+        srv = ((xpaserver_t*)yget_obj(argc - 1, &xpaserver_type))->srv;
+        if (srv->data == NULL) {
+            y_error("XPA server was not created by xpa_publish");
+        }
+        publish_array(srv, argc - 2, snapshot);
+        yarg_drop(argc - 1);
+    } else {
+        help = (yarg_nil(argc - 3) ? NULL : ygets_q(argc - 3));
+        srv = push_server(ygets_q(argc - 1));
+        publish_array(srv, argc - 1, snapshot);
+        register_server(srv, help, "freebuf=false", NULL);
+    }
+}
+
+void Y__xpa_poll(int argc)
+{
+    server_t* srv;
+    long n = 0;
+
+    if (argc > 1 || (argc == 1 && ! yarg_nil(0))) {
+        y_error("expecting no arguments");
+    }
+    if (! serving) {
+        poll_queued = 0;
+        if (servers != NULL) {
+            serving = 1;
+            XPAPoll(0, 0);
+            serving = 0;
+            reap_servers();
+        }
+        watch_servers();
+    }
+    for (srv = servers; srv != NULL; srv = srv->next) {
+        ++n;
+    }
+    ypush_long(n);
+}
+
+/* Serves requests to the access points of Yorick for a given duration (or
+   until there are no more access points).  This is intended for scripts
+   running in batch mode where the event loop is not run. */
+void Y_xpa_serve(int argc)
+{
+    double secs, deadline, t;
+    int msec;
+
+    if (argc > 1) {
+        y_error("expecting at most 1 argument");
+    }
+    secs = (argc < 1 || yarg_nil(0) ? -1.0 : ygets_d(0));
+    if (serving) {
+        y_error("xpa_serve cannot be called by an XPA handler");
+    }
+    deadline = stats_clock() + secs;
+    unwatch_servers();
+    while (servers != NULL) {
+        msec = 100;
+        if (secs >= 0.0) {
+            t = deadline - stats_clock();
+            if (t <= 0.0) {
+                break;
+            }
+            if (t < 0.1) {
+                msec = (int)(1e3*t + 0.5);
+            }
+        }
+        serving = 1;
+        XPAPoll(msec, 0);
+        serving = 0;
+        reap_servers();
+        if (p_signalling) {
+            watch_servers();
+            p_abort();
+        }
+    }
+    watch_servers();
+}
+
+/* Appends the array at `iarg` to the ring of arrays receiving data. */
+static void add_slot(server_t* srv, int iarg)
+{
+    long dims[Y_DIMSIZE];
+    long ntot, k;
+    int typeid = Y_VOID;
+    void* ptr;
+    void** slots;
+    char** bases;
+
+    if (! yarg_number(iarg) || yarg_rank(iarg) < 1) {
+        y_error("receiving arrays must be numerical arrays");
+    }
+    ptr = ygeta_any(iarg, &ntot, dims, &typeid);
+    if (srv->nslots == 0) {
+        srv->slottype = typeid;
+        memcpy(srv->slotdims, dims, (dims[0] + 1)*sizeof(long));
+        srv->slotsize = ntot*elem_size(typeid);
+    } else if (typeid != srv->slottype || dims[0] != srv->slotdims[0]) {
+        goto bad;
+    } else {
+        for (k = 1; k <= dims[0]; ++k) {
+            if (dims[k] != srv->slotdims[k]) {
+                goto bad;
+            }
+        }
+    }
+    slots = (void**)realloc(srv->slots, (srv->nslots + 1)*sizeof(void*));
+    if (slots == NULL) {
+        y_error("insufficient memory");
+    }
+    srv->slots = slots;
+    bases = (char**)realloc(srv->bases, (srv->nslots + 1)*sizeof(char*));
+    if (bases == NULL) {
+        y_error("insufficient memory");
+    }
+    srv->bases = bases;
+    srv->bases[srv->nslots] = (char*)ptr;
+    srv->slots[srv->nslots] = yget_use(iarg);
+    ++srv->nslots;
+    return;
+
+ bad:
+    y_error("receiving arrays must have the same type and shape");
+}
+
+void Y__xpa_receive(int argc)
+{
+    server_t* srv;
+    const char* help;
+
+    if (argc != 3) {
+        y_error("expecting exactly 3 arguments");
+    }
+    if (yarg_typeid(argc - 1) == Y_OPAQUE) {
+        /* Add another receiving array to an existing server. */
+        srv = ((xpaserver_t*)yget_obj(argc - 1, &xpaserver_type))->srv;
+        if (srv->nslots < 1) {
+            y_error("XPA server was not created by xpa_receive");
+        }
+        add_slot(srv, argc - 3);
+        yarg_drop(argc - 1);
+    } else {
+        help = (yarg_nil(argc - 2) ? NULL : ygets_q(argc - 2));
+        srv = push_server(ygets_q(argc - 1));
+        add_slot(srv, argc - 2);
+        register_server(srv, help, NULL, "fillbuf=false");
     }
-    clear_static_arrays();
-    replies = XPASet(client, apt, cmd, NULL, buf, len, srvs, msgs, nmax);
-    push_xpadata();
 }
 
 /*---------------------------------------------------------------------------*/